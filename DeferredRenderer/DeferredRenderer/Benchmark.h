@@ -0,0 +1,316 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Deterministic frame benchmark used by the headless mode. Every frame gets a fixed time value and
+// the camera follows a fixed path, so two runs on the same machine render exactly the same frames
+// and the numbers can be used to gate regressions. The per pass timings come from the Profiler, we
+// just keep every sample instead of a rolling window.
+
+struct BenchmarkSettings
+{
+
+	uint32_t frames = 300;
+	// The scene only depends on the frame index, this is the time that passes between two frames.
+	float timeStep = 1.0f / 60.0f;
+	std::string jsonPath = "benchmark.json";
+	// Optional binary PPM of the last frame, handy to diff against a golden image.
+	std::string capturePath;
+	// Off keeps the camera where the orbit starts, every frame looks the same way.
+	bool orbit = true;
+
+};
+
+// How long the engine took to get ready to render and to finish its first frame, and how much of that
+// went into the programs.
+struct StartupTimings
+{
+
+	double totalMs = 0.0, firstFrameMs = 0.0, programsMs = 0.0;
+	uint32_t cachedPrograms = 0, compiledPrograms = 0;
+	bool parallelCompile = false;
+
+};
+
+class Benchmark
+{
+
+public:
+
+	explicit Benchmark( const BenchmarkSettings& settings ) : settings( settings ) {}
+
+	void init( Profiler& profiler )
+	{
+
+		profiler.onResolved = [ this ]( const FrameTimings& timings ) { record( timings ); };
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			cpuSamples[ i ].reserve( settings.frames );
+			gpuSamples[ i ].reserve( settings.frames );
+
+		}
+		frameSamples.reserve( settings.frames );
+		for( uint16_t i = 0; i < COUNTER_COUNT; ++i )
+		{
+
+			counterSamples[ i ].reserve( settings.frames );
+
+		}
+
+	}
+
+	float timeAt( uint32_t frame ) const
+	{
+
+		return frame * settings.timeStep;
+
+	}
+
+	// A slow orbit around the grid of cubes that bobs up and down a bit, always looking at the center.
+	void cameraAt( float time, glm::vec3& camPos, glm::vec3& camFront ) const
+	{
+
+		if( !settings.orbit )
+		{
+
+			time = 0.0f;
+
+		}
+
+		float angle = time * 0.25f;
+		camPos = glm::vec3( 12.0f * cos( angle ), 4.0f + sin( time * 0.5f ), 12.0f * sin( angle ) );
+		camFront = glm::normalize( glm::vec3( 0.0f, 0.5f, 0.0f ) - camPos );
+
+	}
+
+	void beginFrame()
+	{
+
+		frameStart = std::chrono::high_resolution_clock::now();
+
+	}
+
+	// We don't care about stalling here, we are only benchmarking, so the frame time includes waiting
+	// for the GPU to finish it.
+	void endFrame()
+	{
+
+		glFinish();
+		auto now = std::chrono::high_resolution_clock::now();
+		frameSamples.push_back( std::chrono::duration<double, std::milli>( now - frameStart ).count() );
+
+		// Anything created per frame shows up as a difference between these two.
+		if( frameSamples.size() == 1 )
+		{
+
+			objectsFirstFrame = GLObjects::total();
+
+		}
+		objectsLastFrame = GLObjects::total();
+
+	}
+
+	void setStartup( const StartupTimings& timings )
+	{
+
+		startup = timings;
+
+	}
+
+	// Call once the renderer released everything, whatever is still alive then leaked.
+	void released()
+	{
+
+		objectsAfterFree = GLObjects::total();
+
+	}
+
+	void writeJson( const std::string& renderer, int width, int height ) const
+	{
+
+		std::ofstream file( settings.jsonPath );
+		if( !file )
+		{
+
+			throw std::runtime_error( "Unable to write the benchmark results to " + settings.jsonPath );
+
+		}
+
+		file << "{\n";
+		file << "  \"renderer\": \"" << escape( renderer ) << "\",\n";
+		file << "  \"width\": " << width << ",\n";
+		file << "  \"height\": " << height << ",\n";
+		file << "  \"frames\": " << frameSamples.size() << ",\n";
+		file << "  \"time_step\": " << settings.timeStep << ",\n";
+		file << "  \"frame_ms\": " << stats( frameSamples ) << ",\n";
+		file << "  \"hitches\": " << hitches( frameSamples ) << ",\n";
+		file << "  \"startup\": { \"total_ms\": " << startup.totalMs << ", \"first_frame_ms\": " << startup.firstFrameMs
+			 << ", \"programs_ms\": " << startup.programsMs
+			 << ", \"cached_programs\": " << startup.cachedPrograms << ", \"compiled_programs\": " << startup.compiledPrograms
+			 << ", \"parallel_compile\": " << ( startup.parallelCompile ? "true" : "false" ) << " },\n";
+		file << "  \"passes\": {\n";
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			file << "    \"" << PASS_NAMES[ i ] << "\": { \"cpu_ms\": " << stats( cpuSamples[ i ] )
+				 << ", \"gpu_ms\": " << stats( gpuSamples[ i ] ) << " }" << ( i + 1 < PASS_COUNT ? ",\n" : "\n" );
+
+		}
+		file << "  },\n";
+		file << "  \"counters\": {\n";
+		for( uint16_t i = 0; i < COUNTER_COUNT; ++i )
+		{
+
+			file << "    \"" << COUNTER_NAMES[ i ] << "\": " << stats( counterSamples[ i ] ) << ( i + 1 < COUNTER_COUNT ? ",\n" : "\n" );
+
+		}
+		file << "  },\n";
+		file << "  \"gl_objects\": { \"first_frame\": " << objectsFirstFrame << ", \"last_frame\": " << objectsLastFrame
+			 << ", \"after_free\": " << objectsAfterFree << " }\n";
+		file << "}\n";
+
+	}
+
+	// Binary PPM, rows come bottom to top from glReadPixels so flip them.
+	void writeCapture( int width, int height, const std::vector<unsigned char>& rgb ) const
+	{
+
+		std::ofstream file( settings.capturePath, std::ios::binary );
+		if( !file )
+		{
+
+			throw std::runtime_error( "Unable to write the capture to " + settings.capturePath );
+
+		}
+
+		file << "P6\n" << width << " " << height << "\n255\n";
+		for( int y = height - 1; y >= 0; --y )
+		{
+
+			file.write( ( const char* )&rgb[ ( size_t )y * width * 3 ], ( std::streamsize )width * 3 );
+
+		}
+
+	}
+
+private:
+
+	static constexpr double HITCH_FACTOR = 2.0;
+
+	BenchmarkSettings settings;
+
+	std::chrono::high_resolution_clock::time_point frameStart;
+
+	// One sample per frame, in milliseconds.
+	std::vector<double> cpuSamples[ PASS_COUNT ], gpuSamples[ PASS_COUNT ];
+	std::vector<double> frameSamples;
+	std::vector<double> counterSamples[ COUNTER_COUNT ];
+	// Live GL objects, see GLObjects.h.
+	int64_t objectsFirstFrame = 0, objectsLastFrame = 0, objectsAfterFree = 0;
+	StartupTimings startup;
+
+	// Passes that didn't run in a frame count as 0ms, that way every pass has one sample per frame.
+	void record( const FrameTimings& timings )
+	{
+
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			cpuSamples[ i ].push_back( timings.recorded[ i ] ? timings.cpuMs[ i ] : 0.0 );
+			gpuSamples[ i ].push_back( timings.recorded[ i ] ? timings.gpuMs[ i ] : 0.0 );
+
+		}
+
+		for( uint16_t i = 0; i < COUNTER_COUNT; ++i )
+		{
+
+			counterSamples[ i ].push_back( timings.counters[ i ] );
+
+		}
+
+	}
+
+	static std::string stats( std::vector<double> samples )
+	{
+
+		if( samples.empty() )
+		{
+
+			return "null";
+
+		}
+
+		std::sort( samples.begin(), samples.end() );
+		double sum = 0.0;
+		for( double s : samples )
+		{
+
+			sum += s;
+
+		}
+
+		auto percentile = [ & ]( double p ) { return samples[ ( size_t )( p * ( samples.size() - 1 ) ) ]; };
+
+		return "{ \"min\": " + std::to_string( samples.front() ) +
+			   ", \"avg\": " + std::to_string( sum / samples.size() ) +
+			   ", \"p50\": " + std::to_string( percentile( 0.5 ) ) +
+			   ", \"p99\": " + std::to_string( percentile( 0.99 ) ) +
+			   ", \"max\": " + std::to_string( samples.back() ) + " }";
+
+	}
+
+	// Frames that took more than HITCH_FACTOR times the median, the ones you'd see stutter.
+	static std::string hitches( std::vector<double> samples )
+	{
+
+		if( samples.empty() )
+		{
+
+			return "null";
+
+		}
+
+		std::sort( samples.begin(), samples.end() );
+		double threshold = samples[ ( samples.size() - 1 ) / 2 ] * HITCH_FACTOR;
+		size_t count = samples.end() - std::upper_bound( samples.begin(), samples.end(), threshold );
+		return "{ \"count\": " + std::to_string( count ) + ", \"threshold_ms\": " + std::to_string( threshold ) + " }";
+
+	}
+
+	static std::string escape( const std::string& text )
+	{
+
+		std::string out;
+		for( char c : text )
+		{
+
+			if( c == '"' || c == '\\' )
+			{
+
+				out += '\\';
+
+			}
+			out += c;
+
+		}
+		return out;
+
+	}
+
+};
+
+#endif
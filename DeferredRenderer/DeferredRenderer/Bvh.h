@@ -0,0 +1,404 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the scene objects' boxes, used to throw away everything a view can't
+// see before we draw. It is built once, when objects move their boxes are updated and only the nodes
+// above them get refit, the tree itself stays the same.
+
+struct Aabb
+{
+
+	glm::vec3 min = glm::vec3( 1e30f ), max = glm::vec3( -1e30f );
+
+	void grow( const Aabb& other )
+	{
+
+		min = glm::min( min, other.min );
+		max = glm::max( max, other.max );
+
+	}
+
+	glm::vec3 center() const
+	{
+
+		return ( min + max ) * 0.5f;
+
+	}
+
+	// Box around a [-1, 1] cube after it went through the matrix (the cube mesh's extent).
+	static Aabb fromUnitCube( const glm::mat4& model )
+	{
+
+		glm::vec3 center = glm::vec3( model[3] );
+		glm::vec3 extent = glm::abs( glm::vec3( model[0] ) ) + glm::abs( glm::vec3( model[1] ) ) +
+						   glm::abs( glm::vec3( model[2] ) );
+		Aabb box;
+		box.min = center - extent;
+		box.max = center + extent;
+		return box;
+
+	}
+
+};
+
+// The six planes of a view projection matrix, pointing inwards.
+// https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+struct Frustum
+{
+
+	glm::vec4 planes[ 6 ];
+
+	explicit Frustum( const glm::mat4& viewProjection )
+	{
+
+		glm::vec4 row0( viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0] );
+		glm::vec4 row1( viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1] );
+		glm::vec4 row2( viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2] );
+		glm::vec4 row3( viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3] );
+
+		planes[0] = row3 + row0; // Left.
+		planes[1] = row3 - row0; // Right.
+		planes[2] = row3 + row1; // Bottom.
+		planes[3] = row3 - row1; // Top.
+		planes[4] = row3 + row2; // Near.
+		planes[5] = row3 - row2; // Far.
+
+	}
+
+	// Whether any of the sphere is inside, a sphere near a corner can pass without touching it.
+	bool touches( const glm::vec3& center, float radius ) const
+	{
+
+		for( const glm::vec4& plane : planes )
+		{
+
+			if( glm::dot( glm::vec3( plane ), center ) + plane.w < -radius * glm::length( glm::vec3( plane ) ) )
+			{
+
+				return false;
+
+			}
+
+		}
+		return true;
+
+	}
+
+};
+
+class Bvh
+{
+
+public:
+
+	// Leaves hold up to this many objects.
+	static constexpr uint32_t LEAF_SIZE = 4;
+
+	// One box per object, the object's index is what cull() gives back.
+	void build( const std::vector<Aabb>& boxes )
+	{
+
+		bounds = boxes;
+		nodes.clear();
+		order.resize( boxes.size() );
+		leafOf.resize( boxes.size() );
+		for( uint32_t i = 0; i < order.size(); ++i )
+		{
+
+			order[i] = i;
+
+		}
+
+		if( !boxes.empty() )
+		{
+
+			nodes.reserve( 2 * boxes.size() / LEAF_SIZE + 1 );
+			split( 0, ( uint32_t )boxes.size(), NONE );
+
+		}
+
+		dirty.assign( nodes.size(), 0 );
+		anyDirty = false;
+
+	}
+
+	uint32_t size() const
+	{
+
+		return ( uint32_t )bounds.size();
+
+	}
+
+	// The object moved, its leaf gets refit in the next refit().
+	void update( uint32_t object, const Aabb& box )
+	{
+
+		bounds[ object ] = box;
+		dirty[ leafOf[ object ] ] = 1;
+		anyDirty = true;
+
+	}
+
+	// When (nearly) every object moves: write all the boxes in place, from any number of threads, and
+	// refitAll() afterwards.
+	Aabb* boxes()
+	{
+
+		return bounds.data();
+
+	}
+
+	void refitAll()
+	{
+
+		std::fill( dirty.begin(), dirty.end(), ( uint8_t )1 );
+		anyDirty = true;
+		refit();
+
+	}
+
+	// Children always come after their parent, so walking backwards refits bottom up. Only nodes with a
+	// changed child are touched.
+	void refit()
+	{
+
+		if( !anyDirty )
+		{
+
+			return;
+
+		}
+
+		for( uint32_t i = ( uint32_t )nodes.size(); i-- > 0; )
+		{
+
+			if( !dirty[i] )
+			{
+
+				continue;
+
+			}
+
+			Node& node = nodes[i];
+			Aabb box;
+			if( node.leaf )
+			{
+
+				for( uint32_t j = node.first; j < node.first + node.count; ++j )
+				{
+
+					box.grow( bounds[ order[j] ] );
+
+				}
+
+			}
+
+			else
+			{
+
+				box = nodes[ i + 1 ].bounds;
+				box.grow( nodes[ node.right ].bounds );
+
+			}
+
+			node.bounds = box;
+			dirty[i] = 0;
+			if( node.parent != NONE )
+			{
+
+				dirty[ node.parent ] = 1;
+
+			}
+
+		}
+
+		anyDirty = false;
+
+	}
+
+	// Appends every object whose box touches the frustum to visible, with offset added to its index so
+	// several trees can fill the same list. Once a node is completely inside a plane its children don't
+	// test that plane again, and a node inside all of them takes its whole range without looking any
+	// further.
+	void cull( const Frustum& frustum, std::vector<uint32_t>& visible, uint32_t offset = 0 ) const
+	{
+
+		if( nodes.empty() )
+		{
+
+			return;
+
+		}
+
+		struct Entry
+		{
+
+			uint32_t node;
+			uint8_t planes;
+
+		};
+		Entry stack[ 64 ];
+		uint32_t top = 0;
+		stack[ top++ ] = { 0, 0x3F };
+
+		while( top > 0 )
+		{
+
+			Entry entry = stack[ --top ];
+			const Node& node = nodes[ entry.node ];
+
+			uint8_t planes = entry.planes;
+			bool outside = false;
+			for( uint8_t p = 0; p < 6 && !outside; ++p )
+			{
+
+				if( !( planes & ( 1 << p ) ) )
+				{
+
+					continue;
+
+				}
+
+				const glm::vec4& plane = frustum.planes[p];
+				// The corners furthest along and against the plane's normal.
+				glm::vec3 positive( plane.x >= 0.0f ? node.bounds.max.x : node.bounds.min.x,
+									plane.y >= 0.0f ? node.bounds.max.y : node.bounds.min.y,
+									plane.z >= 0.0f ? node.bounds.max.z : node.bounds.min.z );
+				glm::vec3 negative( plane.x >= 0.0f ? node.bounds.min.x : node.bounds.max.x,
+									plane.y >= 0.0f ? node.bounds.min.y : node.bounds.max.y,
+									plane.z >= 0.0f ? node.bounds.min.z : node.bounds.max.z );
+
+				if( glm::dot( glm::vec3( plane ), positive ) + plane.w < 0.0f )
+				{
+
+					outside = true;
+
+				}
+
+				else if( glm::dot( glm::vec3( plane ), negative ) + plane.w >= 0.0f )
+				{
+
+					planes &= ~( 1 << p );
+
+				}
+
+			}
+
+			if( outside )
+			{
+
+				continue;
+
+			}
+
+			if( node.leaf || planes == 0 )
+			{
+
+				for( uint32_t i = node.first; i < node.first + node.count; ++i )
+				{
+
+					visible.push_back( order[i] + offset );
+
+				}
+
+			}
+
+			else
+			{
+
+				stack[ top++ ] = { node.right, planes };
+				stack[ top++ ] = { entry.node + 1, planes };
+
+			}
+
+		}
+
+	}
+
+private:
+
+	static constexpr uint32_t NONE = 0xFFFFFFFF;
+
+	// The left child is always the next node, first/count is the range of order under the node, for
+	// inner nodes too.
+	struct Node
+	{
+
+		Aabb bounds;
+		uint32_t first, count;
+		uint32_t right, parent;
+		bool leaf;
+
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Aabb> bounds;
+	// Objects sorted so every node's objects are next to each other.
+	std::vector<uint32_t> order;
+	std::vector<uint32_t> leafOf;
+	std::vector<uint8_t> dirty;
+	bool anyDirty = false;
+
+	// Median split along the longest axis of the centers, deep enough trees stay well under the cull
+	// stack's 64 entries (one per level).
+	uint32_t split( uint32_t first, uint32_t count, uint32_t parent )
+	{
+
+		uint32_t index = ( uint32_t )nodes.size();
+		nodes.push_back( Node() );
+
+		Aabb box, centers;
+		for( uint32_t i = first; i < first + count; ++i )
+		{
+
+			box.grow( bounds[ order[i] ] );
+			glm::vec3 center = bounds[ order[i] ].center();
+			centers.grow( { center, center } );
+
+		}
+
+		Node node;
+		node.bounds = box;
+		node.first = first;
+		node.count = count;
+		node.parent = parent;
+		node.right = NONE;
+		node.leaf = count <= LEAF_SIZE;
+
+		if( node.leaf )
+		{
+
+			for( uint32_t i = first; i < first + count; ++i )
+			{
+
+				leafOf[ order[i] ] = index;
+
+			}
+			nodes[ index ] = node;
+			return index;
+
+		}
+
+		glm::vec3 extent = centers.max - centers.min;
+		int axis = extent.x > extent.y ? ( extent.x > extent.z ? 0 : 2 ) : ( extent.y > extent.z ? 1 : 2 );
+		uint32_t half = count / 2;
+		std::nth_element( order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+						  [ & ]( uint32_t a, uint32_t b ) { return bounds[a].center()[axis] < bounds[b].center()[axis]; } );
+
+		nodes[ index ] = node;
+		split( first, half, index );
+		nodes[ index ].right = split( first + half, count - half, index );
+		return index;
+
+	}
+
+};
+
+#endif
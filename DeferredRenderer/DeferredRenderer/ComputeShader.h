@@ -0,0 +1,39 @@
+#ifndef COMPUTE_SHADER_H
+#define COMPUTE_SHADER_H
+
+#include "Shader.h"
+
+// Same idea as Shader but for a single compute stage, it shares the uniform cache and setters.
+class ComputeShader : public Shader
+{
+public:
+	// constructor reads the compute shader and starts building it, defines and finish() work the same way
+	// as in Shader
+	// ------------------------------------------------------------------------
+	ComputeShader(const char* computePath, const std::string& defines = "")
+	{
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
+		}
+		catch (std::ifstream::failure& e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		source = prelude + computeCode;
+		build({ { GL_COMPUTE_SHADER, injectDefines(computeCode, defines) } });
+	}
+	// ------------------------------------------------------------------------
+	void dispatch(GLuint groupsX, GLuint groupsY = 1, GLuint groupsZ = 1) const
+	{
+		glDispatchCompute(groupsX, groupsY, groupsZ);
+	}
+};
+#endif
@@ -0,0 +1,138 @@
+#ifndef DECALS_H
+#define DECALS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "GLObjects.h"
+#include "GLState.h"
+#include "MeshRegistry.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Deferred decals. Every decal is a box, after the G-buffer pass the back faces of every box get drawn
+// and the pixels whose surface (back from the depth) is inside one get its texture blended into their
+// albedo and their normal bent by its relief. The boxes are instances of the cube mesh: the vertices
+// need the box's world matrix and the pixels its inverse, both go in the instance buffer so the inverse
+// is worked out on the CPU once when a box moves instead of for every vertex. Any number of decals is one
+// draw call.
+
+// One decal as decal.vert reads it, a mat4 attribute per matrix.
+struct GpuDecal
+{
+
+	glm::mat4 model;
+	glm::mat4 invModel;
+
+};
+
+static_assert( sizeof( GpuDecal ) == 128, "GpuDecal must match the per instance attributes in decal.vert" );
+
+class DecalBatch
+{
+
+public:
+
+	// After the cube's own attributes, four locations per matrix.
+	static constexpr GLuint MODEL_LOCATION = 3, INV_MODEL_LOCATION = 7;
+
+	void init( const MeshRegistry& meshes, MeshHandle box, uint32_t maxDecals )
+	{
+
+		capacity = maxDecals;
+		GLObjects::genBuffers( 1, &buffer );
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		glBufferData( GL_ARRAY_BUFFER, std::max<uint32_t>( capacity, 1 ) * sizeof( GpuDecal ), nullptr, GL_DYNAMIC_DRAW );
+
+		GLObjects::genVertexArrays( 1, &vertexArrayObject );
+		GLState::bindVertexArray( vertexArrayObject );
+		meshes.bindAttributes( box );
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		for( GLuint column = 0; column < 4; ++column )
+		{
+
+			instanceAttribute( MODEL_LOCATION + column, offsetof( GpuDecal, model ) + column * sizeof( glm::vec4 ) );
+			instanceAttribute( INV_MODEL_LOCATION + column, offsetof( GpuDecal, invModel ) + column * sizeof( glm::vec4 ) );
+
+		}
+
+		GLState::bindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	}
+
+	// The boxes' world matrices to what the shaders read, nothing but maths so any thread can do it.
+	static void build( const glm::mat4* worlds, uint32_t count, GpuDecal* decals )
+	{
+
+		for( uint32_t i = 0; i < count; ++i )
+		{
+
+			decals[i].model = worlds[i];
+			decals[i].invModel = glm::inverse( worlds[i] );
+
+		}
+
+	}
+
+	// Only when a box moved, the buffer keeps them otherwise.
+	void upload( const GpuDecal* decals, uint32_t count )
+	{
+
+		count = std::min( count, capacity );
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		glBufferSubData( GL_ARRAY_BUFFER, 0, count * sizeof( GpuDecal ), decals );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+		uploaded = count;
+
+	}
+
+	// Every decal at once, the caller sets the shader and the blending up.
+	void draw( const MeshRegistry& meshes, MeshHandle box ) const
+	{
+
+		if( uploaded > 0 )
+		{
+
+			meshes.drawInstanced( box, vertexArrayObject, ( GLsizei )uploaded );
+
+		}
+
+	}
+
+	uint32_t size() const
+	{
+
+		return uploaded;
+
+	}
+
+	void free()
+	{
+
+		GLObjects::deleteVertexArrays( 1, &vertexArrayObject );
+		GLObjects::deleteBuffers( 1, &buffer );
+		capacity = uploaded = 0;
+
+	}
+
+private:
+
+	GLuint buffer = 0, vertexArrayObject = 0;
+	uint32_t capacity = 0, uploaded = 0;
+
+	static void instanceAttribute( GLuint location, size_t offset )
+	{
+
+		glVertexAttribPointer( location, 4, GL_FLOAT, GL_FALSE, sizeof( GpuDecal ), ( void* )offset );
+		glEnableVertexAttribArray( location );
+		glVertexAttribDivisor( location, 1 );
+
+	}
+
+};
+
+#endif
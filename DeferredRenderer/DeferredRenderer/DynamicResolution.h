@@ -0,0 +1,140 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+// Keeps the GPU frame time under a budget by rendering the G-buffer, the shadow mask and the lighting at
+// a fraction of the output's size, the upscale pass stretches the result back over the output. The GPU
+// times come back from the profiler a couple of frames late, so the controller smooths them, only moves
+// in coarse steps and lets a change reach the timings before it looks at them again: every change
+// re-creates the render targets, and a scale that bounces around every frame looks worse than either
+// resolution.
+
+struct DynamicResolutionSettings
+{
+
+	// Off always renders at the output's size.
+	bool enabled = false;
+	// The GPU time we want a frame to take, in milliseconds.
+	float budgetMs = 16.0f;
+	// How far the render size can go, per axis, 1 is the output's size.
+	float minScale = 0.5f, maxScale = 1.0f;
+	// The scale only ever is a multiple of this.
+	float step = 0.05f;
+
+};
+
+class DynamicResolution
+{
+
+public:
+
+	void init( const DynamicResolutionSettings& resolutionSettings )
+	{
+
+		settings = resolutionSettings;
+		if( settings.step <= 0.0f || settings.minScale < settings.step || settings.minScale > settings.maxScale ||
+			settings.maxScale > 1.0f )
+		{
+
+			throw std::runtime_error( "The resolution scale has to be between one step and 1!" );
+
+		}
+		current = settings.maxScale;
+
+	}
+
+	float scale() const
+	{
+
+		return current;
+
+	}
+
+	// The render size for an output this big, at least one pixel.
+	uint32_t scaled( uint32_t size ) const
+	{
+
+		return std::max<uint32_t>( ( uint32_t )std::lround( size * current ), 1 );
+
+	}
+
+	// Feeds the newest resolved frame, once per rendered frame. Returns true when the scale changed, the
+	// render targets have to follow before the next frame.
+	bool update( const FrameTimings& timings )
+	{
+
+		if( !settings.enabled || timings.frame == UINT64_MAX || timings.frame == lastFrame )
+		{
+
+			return false;
+
+		}
+		lastFrame = timings.frame;
+
+		// Frames that were already queued when the scale changed still come back at the old size.
+		if( settle > 0 )
+		{
+
+			--settle;
+			return false;
+
+		}
+
+		double gpuMs = 0.0;
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			gpuMs += timings.recorded[i] ? timings.gpuMs[i] : 0.0;
+
+		}
+		smoothed = samples == 0 ? gpuMs : smoothed + ( gpuMs - smoothed ) * SMOOTHING;
+		if( ++samples < MIN_SAMPLES )
+		{
+
+			return false;
+
+		}
+
+		// Most of what we save goes with the pixel count, the square of the scale. Aim a bit under the
+		// budget so the noise doesn't keep pushing us over, going down takes as many steps as it needs
+		// while going up only takes one at a time: too slow is worse than too blurry.
+		float wanted = current * ( float )std::sqrt( settings.budgetMs * HEADROOM / std::max( smoothed, 1.0e-3 ) );
+		float next = std::round( wanted / settings.step ) * settings.step;
+		next = std::min( std::max( next, settings.minScale ), std::min( settings.maxScale, current + settings.step ) );
+		if( std::abs( next - current ) < settings.step * 0.5f )
+		{
+
+			return false;
+
+		}
+
+		current = next;
+		samples = 0;
+		settle = Profiler::QUERY_BUFFERS + 1;
+		return true;
+
+	}
+
+private:
+
+	// How much of every new frame time goes into the average.
+	static constexpr double SMOOTHING = 0.2;
+	static constexpr double HEADROOM = 0.9;
+	// Frames at a scale before we trust its average.
+	static constexpr uint32_t MIN_SAMPLES = 8;
+
+	DynamicResolutionSettings settings;
+	float current = 1.0f;
+	double smoothed = 0.0;
+	uint32_t samples = 0, settle = 0;
+	uint64_t lastFrame = UINT64_MAX;
+
+};
+
+#endif
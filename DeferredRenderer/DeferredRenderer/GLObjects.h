@@ -0,0 +1,296 @@
+#ifndef GL_OBJECTS_H
+#define GL_OBJECTS_H
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+
+#include <cstdint>
+#include <ostream>
+
+// Leak accounting for every GL object the engine owns. Creating and deleting goes through these
+// wrappers instead of calling glGen*/glDelete* directly, they keep a live count per object type so a
+// long session (or the benchmark) can check that the number of objects stays flat and that free()
+// really releases everything.
+// Deleting zeroes the names, so deleting twice or deleting a name that was never created (0) doesn't
+// throw the counts off.
+
+enum GLObjectType
+{
+
+	GL_OBJECT_BUFFER = 0,
+	GL_OBJECT_VERTEX_ARRAY,
+	GL_OBJECT_TEXTURE,
+	GL_OBJECT_FRAMEBUFFER,
+	GL_OBJECT_RENDERBUFFER,
+	GL_OBJECT_QUERY,
+	GL_OBJECT_PROGRAM,
+	GL_OBJECT_SYNC,
+	GL_OBJECT_SAMPLER,
+	GL_OBJECT_COUNT
+
+};
+
+static const char* GL_OBJECT_NAMES[ GL_OBJECT_COUNT ] =
+{
+
+	"buffers", "vertex_arrays", "textures", "framebuffers", "renderbuffers", "queries", "programs", "syncs", "samplers"
+
+};
+
+class GLObjects
+{
+
+public:
+
+	static void genBuffers( GLsizei n, GLuint* names )
+	{
+
+		glGenBuffers( n, names );
+		created( GL_OBJECT_BUFFER, n );
+
+	}
+
+	static void deleteBuffers( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_BUFFER, n, names );
+		glDeleteBuffers( n, names );
+		clear( n, names );
+
+	}
+
+	static void genVertexArrays( GLsizei n, GLuint* names )
+	{
+
+		glGenVertexArrays( n, names );
+		created( GL_OBJECT_VERTEX_ARRAY, n );
+
+	}
+
+	static void deleteVertexArrays( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_VERTEX_ARRAY, n, names );
+		glDeleteVertexArrays( n, names );
+		GLState::deletedVertexArrays( n, names );
+		clear( n, names );
+
+	}
+
+	static void genTextures( GLsizei n, GLuint* names )
+	{
+
+		glGenTextures( n, names );
+		created( GL_OBJECT_TEXTURE, n );
+
+	}
+
+	static void deleteTextures( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_TEXTURE, n, names );
+		glDeleteTextures( n, names );
+		GLState::deletedTextures( n, names );
+		clear( n, names );
+
+	}
+
+	static void genFramebuffers( GLsizei n, GLuint* names )
+	{
+
+		glGenFramebuffers( n, names );
+		created( GL_OBJECT_FRAMEBUFFER, n );
+
+	}
+
+	static void deleteFramebuffers( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_FRAMEBUFFER, n, names );
+		glDeleteFramebuffers( n, names );
+		clear( n, names );
+
+	}
+
+	static void genRenderbuffers( GLsizei n, GLuint* names )
+	{
+
+		glGenRenderbuffers( n, names );
+		created( GL_OBJECT_RENDERBUFFER, n );
+
+	}
+
+	static void deleteRenderbuffers( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_RENDERBUFFER, n, names );
+		glDeleteRenderbuffers( n, names );
+		clear( n, names );
+
+	}
+
+	static void genSamplers( GLsizei n, GLuint* names )
+	{
+
+		glGenSamplers( n, names );
+		created( GL_OBJECT_SAMPLER, n );
+
+	}
+
+	static void deleteSamplers( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_SAMPLER, n, names );
+		glDeleteSamplers( n, names );
+		GLState::deletedSamplers( n, names );
+		clear( n, names );
+
+	}
+
+	static void genQueries( GLsizei n, GLuint* names )
+	{
+
+		glGenQueries( n, names );
+		created( GL_OBJECT_QUERY, n );
+
+	}
+
+	static void deleteQueries( GLsizei n, GLuint* names )
+	{
+
+		deleted( GL_OBJECT_QUERY, n, names );
+		glDeleteQueries( n, names );
+		clear( n, names );
+
+	}
+
+	static GLuint createProgram()
+	{
+
+		GLuint program = glCreateProgram();
+		if( program != 0 )
+		{
+
+			created( GL_OBJECT_PROGRAM, 1 );
+
+		}
+		return program;
+
+	}
+
+	static void deleteProgram( GLuint& program )
+	{
+
+		deleted( GL_OBJECT_PROGRAM, 1, &program );
+		glDeleteProgram( program );
+		GLState::deletedProgram( program );
+		program = 0;
+
+	}
+
+	static GLsync fenceSync()
+	{
+
+		GLsync sync = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		if( sync )
+		{
+
+			created( GL_OBJECT_SYNC, 1 );
+
+		}
+		return sync;
+
+	}
+
+	static void deleteSync( GLsync& sync )
+	{
+
+		if( sync )
+		{
+
+			--live[ GL_OBJECT_SYNC ];
+			glDeleteSync( sync );
+			sync = nullptr;
+
+		}
+
+	}
+
+	static int64_t count( GLObjectType type )
+	{
+
+		return live[ type ];
+
+	}
+
+	static int64_t total()
+	{
+
+		int64_t sum = 0;
+		for( uint16_t i = 0; i < GL_OBJECT_COUNT; ++i )
+		{
+
+			sum += live[ i ];
+
+		}
+		return sum;
+
+	}
+
+	static void dump( std::ostream& out )
+	{
+
+		out << "GL objects alive: " << total() << " (";
+		for( uint16_t i = 0; i < GL_OBJECT_COUNT; ++i )
+		{
+
+			out << GL_OBJECT_NAMES[ i ] << " " << live[ i ] << ( i + 1 < GL_OBJECT_COUNT ? ", " : ")\n" );
+
+		}
+
+	}
+
+private:
+
+	static inline int64_t live[ GL_OBJECT_COUNT ] = {};
+
+	static void created( GLObjectType type, GLsizei n )
+	{
+
+		live[ type ] += n;
+
+	}
+
+	static void deleted( GLObjectType type, GLsizei n, const GLuint* names )
+	{
+
+		for( GLsizei i = 0; i < n; ++i )
+		{
+
+			if( names[ i ] != 0 )
+			{
+
+				--live[ type ];
+
+			}
+
+		}
+
+	}
+
+	static void clear( GLsizei n, GLuint* names )
+	{
+
+		for( GLsizei i = 0; i < n; ++i )
+		{
+
+			names[ i ] = 0;
+
+		}
+
+	}
+
+};
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+// Shadows the bindings every pass keeps setting, the program, the active texture unit, the textures and
+// samplers on every unit and the vertex array, and only calls GL when one of them really changes. Every
+// pass used to use its program and bind its textures and vertex arrays from scratch even when the
+// previous pass left the same ones bound, each of those calls costs real CPU time on drivers that
+// validate state on the CPU (and on llvmpipe, where everything is the CPU).
+// Everything binding those has to go through here, a bind behind the cache's back makes it lie: call
+// invalidate() after code that can't. Deleting through GLObjects forgets the deleted names, GL unbinds
+// them and their names can come back for new objects.
+// The counts say how many binds got through and how many were dropped as redundant.
+
+class GLState
+{
+
+public:
+
+	// Units we track, binds past them always go to GL.
+	static constexpr GLuint MAX_UNITS = 16;
+
+	static void useProgram( GLuint program )
+	{
+
+		if( program == current.program )
+		{
+
+			++skipped;
+			return;
+
+		}
+		glUseProgram( program );
+		current.program = program;
+		++issued;
+
+	}
+
+	static void activeTexture( GLuint unit )
+	{
+
+		if( unit == current.activeUnit )
+		{
+
+			++skipped;
+			return;
+
+		}
+		glActiveTexture( GL_TEXTURE0 + unit );
+		current.activeUnit = unit;
+		++issued;
+
+	}
+
+	// Binds to the active unit, for creating and editing textures.
+	static void bindTexture( GLenum target, GLuint texture )
+	{
+
+		bindTexture( current.activeUnit != UNKNOWN ? current.activeUnit : 0, target, texture );
+
+	}
+
+	static void bindTexture( GLuint unit, GLenum target, GLuint texture )
+	{
+
+		int slot = targetSlot( target );
+		if( unit < MAX_UNITS && slot >= 0 && current.textures[ unit ][ slot ] == texture )
+		{
+
+			++skipped;
+			return;
+
+		}
+		activeTexture( unit );
+		glBindTexture( target, texture );
+		if( unit < MAX_UNITS && slot >= 0 )
+		{
+
+			current.textures[ unit ][ slot ] = texture;
+
+		}
+		++issued;
+
+	}
+
+	static void bindSampler( GLuint unit, GLuint sampler )
+	{
+
+		if( unit < MAX_UNITS && current.samplers[ unit ] == sampler )
+		{
+
+			++skipped;
+			return;
+
+		}
+		glBindSampler( unit, sampler );
+		if( unit < MAX_UNITS )
+		{
+
+			current.samplers[ unit ] = sampler;
+
+		}
+		++issued;
+
+	}
+
+	static void bindVertexArray( GLuint vertexArray )
+	{
+
+		if( vertexArray == current.vertexArray )
+		{
+
+			++skipped;
+			return;
+
+		}
+		glBindVertexArray( vertexArray );
+		current.vertexArray = vertexArray;
+		++issued;
+
+	}
+
+	// GL unbinds deleted objects, from every unit for textures and samplers.
+	static void deletedTextures( GLsizei n, const GLuint* names )
+	{
+
+		for( GLsizei i = 0; i < n; ++i )
+		{
+
+			for( GLuint unit = 0; unit < MAX_UNITS; ++unit )
+			{
+
+				for( GLuint& texture : current.textures[ unit ] )
+				{
+
+					texture = texture == names[i] ? 0 : texture;
+
+				}
+
+			}
+
+		}
+
+	}
+
+	static void deletedSamplers( GLsizei n, const GLuint* names )
+	{
+
+		for( GLsizei i = 0; i < n; ++i )
+		{
+
+			for( GLuint& sampler : current.samplers )
+			{
+
+				sampler = sampler == names[i] ? 0 : sampler;
+
+			}
+
+		}
+
+	}
+
+	static void deletedVertexArrays( GLsizei n, const GLuint* names )
+	{
+
+		for( GLsizei i = 0; i < n; ++i )
+		{
+
+			current.vertexArray = current.vertexArray == names[i] ? 0 : current.vertexArray;
+
+		}
+
+	}
+
+	// A program that is in use stays alive until something else is used, we just won't skip the next use.
+	static void deletedProgram( GLuint program )
+	{
+
+		current.program = current.program == program ? UNKNOWN : current.program;
+
+	}
+
+	// Someone bound behind our back, the next bind of everything goes to GL.
+	static void invalidate()
+	{
+
+		current.program = current.vertexArray = current.activeUnit = UNKNOWN;
+		for( GLuint unit = 0; unit < MAX_UNITS; ++unit )
+		{
+
+			current.samplers[ unit ] = UNKNOWN;
+			for( GLuint& texture : current.textures[ unit ] )
+			{
+
+				texture = UNKNOWN;
+
+			}
+
+		}
+
+	}
+
+	// Binds that reached GL and binds dropped because nothing would have changed, since resetCounts().
+	static uint64_t issuedBinds()
+	{
+
+		return issued;
+
+	}
+
+	static uint64_t skippedBinds()
+	{
+
+		return skipped;
+
+	}
+
+	static void resetCounts()
+	{
+
+		issued = skipped = 0;
+
+	}
+
+private:
+
+	// GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY, the only targets we bind.
+	static constexpr int TARGETS = 2;
+	// No GL name is ever this, whatever gets bound next goes through.
+	static constexpr GLuint UNKNOWN = UINT32_MAX;
+
+	// Zeroed is a fresh context: everything bound to 0 and unit 0 active.
+	struct State
+	{
+
+		GLuint program, vertexArray, activeUnit;
+		GLuint textures[ MAX_UNITS ][ TARGETS ];
+		GLuint samplers[ MAX_UNITS ];
+
+	};
+
+	static inline State current = {};
+	static inline uint64_t issued = 0, skipped = 0;
+
+	static int targetSlot( GLenum target )
+	{
+
+		return target == GL_TEXTURE_2D ? 0 : target == GL_TEXTURE_2D_ARRAY ? 1 : -1;
+
+	}
+
+};
+
+#endif
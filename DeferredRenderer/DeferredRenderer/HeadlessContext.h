@@ -0,0 +1,135 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+// An OpenGL context without a window, meant for machines that have no display at all (our CI render
+// nodes only have Mesa's llvmpipe). It uses EGL's surfaceless platform so there is no default
+// framebuffer, whoever renders with it has to provide its own FBO.
+// Only compiled in when HEADLESS_EGL is defined, the Windows build keeps using GLFW exclusively.
+
+#ifdef HEADLESS_EGL
+// Keep X11 out of the picture, it #defines things like None and Status.
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <stdexcept>
+
+class HeadlessContext
+{
+
+public:
+
+	void create( int major, int minor )
+	{
+
+#ifdef HEADLESS_EGL
+		// Prefer Mesa's surfaceless platform, it does not need a GPU, a display server or even a
+		// /dev/dri node.
+		auto getPlatformDisplay = ( PFNEGLGETPLATFORMDISPLAYEXTPROC )eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+		if( getPlatformDisplay )
+		{
+
+			display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+
+		}
+
+		if( display == EGL_NO_DISPLAY )
+		{
+
+			display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+		}
+
+		EGLint eglMajor, eglMinor;
+		if( display == EGL_NO_DISPLAY || !eglInitialize( display, &eglMajor, &eglMinor ) )
+		{
+
+			throw std::runtime_error( "Unable to initialize an EGL display!" );
+
+		}
+
+		if( !eglBindAPI( EGL_OPENGL_API ) )
+		{
+
+			throw std::runtime_error( "EGL display does not support desktop OpenGL!" );
+
+		}
+
+		// No config and no surface, EGL_KHR_no_config_context + EGL_KHR_surfaceless_context.
+		const EGLint contextAttributes[] =
+		{
+			EGL_CONTEXT_MAJOR_VERSION, major,
+			EGL_CONTEXT_MINOR_VERSION, minor,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext( display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes );
+		if( context == EGL_NO_CONTEXT )
+		{
+
+			throw std::runtime_error( "Failed to create a headless OpenGL context!" );
+
+		}
+
+		if( !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) )
+		{
+
+			throw std::runtime_error( "Failed to make the headless OpenGL context current!" );
+
+		}
+#else
+		( void )major;
+		( void )minor;
+		throw std::runtime_error( "Headless mode is not available, build with HEADLESS_EGL defined!" );
+#endif
+
+	}
+
+	void destroy()
+	{
+
+#ifdef HEADLESS_EGL
+		if( display != EGL_NO_DISPLAY )
+		{
+
+			eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+			if( context != EGL_NO_CONTEXT )
+			{
+
+				eglDestroyContext( display, context );
+
+			}
+			eglTerminate( display );
+
+		}
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+#endif
+
+	}
+
+	// Handed to glad, the same way we hand it glfwGetProcAddress.
+	static void* getProcAddress( const char* name )
+	{
+
+#ifdef HEADLESS_EGL
+		return ( void* )eglGetProcAddress( name );
+#else
+		( void )name;
+		return nullptr;
+#endif
+
+	}
+
+private:
+
+#ifdef HEADLESS_EGL
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+
+};
+
+#endif
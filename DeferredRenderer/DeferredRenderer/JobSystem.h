@@ -0,0 +1,321 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work stealing job system for the CPU side of a frame. Every thread has its own queue: it
+// pushes and pops at the back of it (the newest jobs, their data is still in cache) and when it runs
+// out it steals from the front of someone else's. The thread that owns the GL context is queue 0, it
+// never sleeps in here, it only helps with jobs while it waits for a group to finish.
+// Background jobs (runBackground) are long ones nobody waits for this frame, like decoding a texture:
+// they sit in a queue of their own that only the workers take from, the GL thread never picks one up
+// while it waits for a frame's jobs.
+// Jobs must not touch GL, only the GL thread may do that.
+
+class JobSystem
+{
+
+public:
+
+	typedef std::function<void()> Job;
+
+	// Jobs that are waited on together, run() adds to it and wait() returns once it is back to 0.
+	struct Group
+	{
+
+		std::atomic<uint32_t> pending{ 0 };
+
+	};
+
+	// With 0 workers every job runs on the thread that waits for it, the results are the same.
+	void init( uint32_t workerCount )
+	{
+
+		running = true;
+		for( uint32_t i = 0; i <= workerCount; ++i )
+		{
+
+			queues.push_back( std::unique_ptr<Queue>( new Queue() ) );
+
+		}
+
+		for( uint32_t i = 1; i <= workerCount; ++i )
+		{
+
+			workers.emplace_back( [ this, i ]() { workerLoop( i ); } );
+
+		}
+
+	}
+
+	// Workers plus the GL thread.
+	uint32_t threads() const
+	{
+
+		return ( uint32_t )queues.size();
+
+	}
+
+	void run( Group& group, Job job )
+	{
+
+		group.pending.fetch_add( 1 );
+		Queue& queue = *queues[ queueIndex ];
+		{
+
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			queue.jobs.push_back( { std::move( job ), &group } );
+
+		}
+
+		{
+
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			++queued;
+
+		}
+		wake.notify_one();
+
+	}
+
+	// Queued behind everything else and only run by a worker, the group tells when it is done. Without
+	// workers it runs right here.
+	void runBackground( Group& group, Job job )
+	{
+
+		if( workers.empty() )
+		{
+
+			job();
+			return;
+
+		}
+
+		group.pending.fetch_add( 1 );
+		{
+
+			std::lock_guard<std::mutex> lock( background.mutex );
+			background.jobs.push_back( { std::move( job ), &group } );
+
+		}
+
+		{
+
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			++queued;
+
+		}
+		wake.notify_one();
+
+	}
+
+	// Runs jobs (any jobs, not just the group's) until the group is done.
+	void wait( Group& group )
+	{
+
+		while( group.pending.load() > 0 )
+		{
+
+			if( !runOne( queueIndex ) )
+			{
+
+				std::this_thread::yield();
+
+			}
+
+		}
+
+	}
+
+	// Calls body( begin, end ) over [0, count) in chunks of at least grain elements, split over every
+	// thread, and returns once all of them are done.
+	void parallelFor( uint32_t count, uint32_t grain, const std::function<void( uint32_t, uint32_t )>& body )
+	{
+
+		if( count == 0 )
+		{
+
+			return;
+
+		}
+
+		uint32_t chunk = std::max( grain, ( count + threads() * 4 - 1 ) / ( threads() * 4 ) );
+		if( chunk >= count )
+		{
+
+			body( 0, count );
+			return;
+
+		}
+
+		Group group;
+		for( uint32_t begin = 0; begin < count; begin += chunk )
+		{
+
+			uint32_t end = std::min( count, begin + chunk );
+			run( group, [ &body, begin, end ]() { body( begin, end ); } );
+
+		}
+		wait( group );
+
+	}
+
+	void free()
+	{
+
+		{
+
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			running = false;
+
+		}
+		wake.notify_all();
+		for( std::thread& worker : workers )
+		{
+
+			worker.join();
+
+		}
+		workers.clear();
+		queues.clear();
+		// Background jobs nobody got to are dropped.
+		background.jobs.clear();
+		queued = 0;
+
+	}
+
+private:
+
+	struct Entry
+	{
+
+		Job job;
+		Group* group;
+
+	};
+
+	struct Queue
+	{
+
+		std::mutex mutex;
+		std::deque<Entry> jobs;
+
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	Queue background;
+	std::vector<std::thread> workers;
+
+	// Idle workers sleep on wake, queued counts the jobs that sit in any queue. It can dip below 0 for
+	// a moment when a job gets taken before run() counted it.
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	int32_t queued = 0;
+	bool running = false;
+
+	// Which queue belongs to the calling thread, 0 unless it is one of our workers.
+	static inline thread_local uint32_t queueIndex = 0;
+
+	bool take( Queue& queue, bool newest, Entry& entry )
+	{
+
+		std::lock_guard<std::mutex> lock( queue.mutex );
+		if( queue.jobs.empty() )
+		{
+
+			return false;
+
+		}
+
+		if( newest )
+		{
+
+			entry = std::move( queue.jobs.back() );
+			queue.jobs.pop_back();
+
+		}
+
+		else
+		{
+
+			entry = std::move( queue.jobs.front() );
+			queue.jobs.pop_front();
+
+		}
+		return true;
+
+	}
+
+	// Our own newest job first, otherwise the oldest job of the next queue that has one, and background
+	// jobs last, never on the GL thread.
+	bool runOne( uint32_t index )
+	{
+
+		Entry entry;
+		bool found = take( *queues[ index ], true, entry );
+		for( uint32_t i = 1; !found && i < queues.size(); ++i )
+		{
+
+			found = take( *queues[ ( index + i ) % queues.size() ], false, entry );
+
+		}
+		found = found || ( index != 0 && take( background, false, entry ) );
+
+		if( !found )
+		{
+
+			return false;
+
+		}
+
+		{
+
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			--queued;
+
+		}
+		entry.job();
+		entry.group->pending.fetch_sub( 1 );
+		return true;
+
+	}
+
+	void workerLoop( uint32_t index )
+	{
+
+		queueIndex = index;
+		while( true )
+		{
+
+			if( runOne( index ) )
+			{
+
+				continue;
+
+			}
+
+			std::unique_lock<std::mutex> lock( sleepMutex );
+			wake.wait( lock, [ this ]() { return queued > 0 || !running; } );
+			if( !running )
+			{
+
+				return;
+
+			}
+
+		}
+
+	}
+
+};
+
+#endif
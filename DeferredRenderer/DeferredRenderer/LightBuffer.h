@@ -0,0 +1,255 @@
+#ifndef LIGHT_BUFFER_H
+#define LIGHT_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "GLObjects.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Point light as the lighting shaders see it. Laid out so it is identical under std140 and std430:
+// every vec3 is followed by a float that fills the rest of its 16 bytes.
+struct GpuLight
+{
+
+	glm::vec3 position;
+	float radius;
+	glm::vec3 colour;
+	float linear;
+	float quadratic;
+	// Its first face in the shadow atlas' views, -1 without shadows (see ShadowAtlas.h).
+	int32_t shadow;
+	float padding[ 2 ];
+
+};
+
+static_assert( sizeof( GpuLight ) == 48, "GpuLight must match the Light struct in prelude.glsl" );
+
+// The point light list lives in a Shader Storage Buffer so the shader can read as many lights as we
+// want instead of a fixed size uniform array. Whenever the driver lets us (GL 4.4+) the buffer is
+// persistently mapped and split in REGIONS parts, every frame we write into the next one with a
+// single memcpy and a fence tells us when the GPU is done reading it, older drivers orphan and
+// re-upload.
+// Drivers that can't read SSBOs from the fragment stage get a Uniform Buffer instead, capped at
+// MAX_UBO_LIGHTS, the shaders pick the matching declaration through LIGHTS_UBO (see defines()).
+class LightBuffer
+{
+
+public:
+
+	static constexpr GLuint BINDING = 0;
+	static constexpr uint32_t MAX_UBO_LIGHTS = 256;
+
+	void init( uint32_t maxLights )
+	{
+
+		GLint fragmentBlocks = 0;
+		if( GLAD_GL_VERSION_4_3 )
+		{
+
+			glGetIntegerv( GL_MAX_FRAGMENT_SHADER_STORAGE_BLOCKS, &fragmentBlocks );
+
+		}
+
+		useStorage = fragmentBlocks > 0;
+		target = useStorage ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
+		capacity = useStorage ? maxLights : std::min( maxLights, MAX_UBO_LIGHTS );
+
+		GLint alignment = 1;
+		glGetIntegerv( useStorage ? GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT : GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,
+					   &alignment );
+		// Never hand out an empty range, even without lights.
+		regionSize = std::max<GLsizeiptr>( capacity, 1 ) * sizeof( GpuLight );
+		regionSize = ( regionSize + alignment - 1 ) / alignment * alignment;
+
+		GLObjects::genBuffers( 1, &buffer );
+		glBindBuffer( target, buffer );
+
+		persistent = GLAD_GL_VERSION_4_4 != 0;
+		if( persistent )
+		{
+
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage( target, regionSize * REGIONS, nullptr, flags );
+			mapped = ( unsigned char* )glMapBufferRange( target, 0, regionSize * REGIONS, flags );
+			if( !mapped )
+			{
+
+				throw std::runtime_error( "Unable to map the light buffer!" );
+
+			}
+
+		}
+
+		else
+		{
+
+			glBufferData( target, regionSize, nullptr, GL_STREAM_DRAW );
+
+		}
+
+		glBindBuffer( target, 0 );
+
+	}
+
+	// Extra #defines for every shader that reads the light list, LIGHT_LIST pulls its declaration in from
+	// prelude.glsl.
+	std::string defines() const
+	{
+
+		std::string defines = "#define LIGHT_LIST\n";
+		if( !useStorage )
+		{
+
+			defines += "#define LIGHTS_UBO\n#define MAX_UBO_LIGHTS " + std::to_string( MAX_UBO_LIGHTS ) + "\n";
+
+		}
+		return defines;
+
+	}
+
+	bool usesStorage() const
+	{
+
+		return useStorage;
+
+	}
+
+	// Copies the whole list for this frame and binds it, lights past the capacity are dropped.
+	// Returns the number of lights the shaders should loop over.
+	uint32_t upload( const GpuLight* lights, uint32_t count )
+	{
+
+		count = std::min( count, capacity );
+		GLsizeiptr size = count * sizeof( GpuLight );
+
+		if( persistent )
+		{
+
+			region = ( region + 1 ) % REGIONS;
+			waitForRegion( region );
+			std::memcpy( mapped + region * regionSize, lights, size );
+			glBindBufferRange( target, BINDING, buffer, region * regionSize, regionSize );
+
+		}
+
+		else
+		{
+
+			// Orphan the old storage so we don't wait for the GPU to finish with last frame's lights.
+			glBindBuffer( target, buffer );
+			glBufferData( target, regionSize, nullptr, GL_STREAM_DRAW );
+			glBufferSubData( target, 0, size, lights );
+			glBindBuffer( target, 0 );
+			glBindBufferRange( target, BINDING, buffer, 0, regionSize );
+
+		}
+
+		return count;
+
+	}
+
+	// Call once every pass that reads this frame's lights has been submitted.
+	void endFrame()
+	{
+
+		if( persistent )
+		{
+
+			if( fences[ region ] )
+			{
+
+				GLObjects::deleteSync( fences[ region ] );
+
+			}
+			fences[ region ] = GLObjects::fenceSync();
+
+		}
+
+	}
+
+	void free()
+	{
+
+		for( GLsync& fence : fences )
+		{
+
+			if( fence )
+			{
+
+				GLObjects::deleteSync( fence );
+				fence = nullptr;
+
+			}
+
+		}
+
+		if( persistent && mapped )
+		{
+
+			glBindBuffer( target, buffer );
+			glUnmapBuffer( target );
+			glBindBuffer( target, 0 );
+			mapped = nullptr;
+
+		}
+
+		GLObjects::deleteBuffers( 1, &buffer );
+
+	}
+
+private:
+
+	// One region being written by the CPU, the others possibly still read by frames in flight.
+	static constexpr uint16_t REGIONS = 3;
+
+	GLuint buffer = 0;
+	GLenum target = GL_SHADER_STORAGE_BUFFER;
+	bool useStorage = true, persistent = false;
+	uint32_t capacity = 0;
+	GLsizeiptr regionSize = 0;
+
+	unsigned char* mapped = nullptr;
+	uint16_t region = 0;
+	GLsync fences[ REGIONS ] = {};
+
+	void waitForRegion( uint16_t index )
+	{
+
+		if( !fences[ index ] )
+		{
+
+			return;
+
+		}
+
+		// Almost always signaled already, if not flush once and keep waiting.
+		GLbitfield flags = 0;
+		while( true )
+		{
+
+			GLenum result = glClientWaitSync( fences[ index ], flags, 1000000 );
+			if( result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED )
+			{
+
+				break;
+
+			}
+			flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+		}
+
+		GLObjects::deleteSync( fences[ index ] );
+		fences[ index ] = nullptr;
+
+	}
+
+};
+
+#endif
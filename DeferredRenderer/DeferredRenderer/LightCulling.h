@@ -0,0 +1,137 @@
+#ifndef LIGHT_CULLING_H
+#define LIGHT_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "ComputeShader.h"
+#include "GLObjects.h"
+#include "LightBuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+// Tiled light assignment. The screen is split in TILE_SIZE x TILE_SIZE tiles and a compute shader
+// builds, for every tile, the list of point lights whose sphere touches any of the tile's G-buffer
+// positions (rebuilt from the depth), the lighting pass then only loops over its tile's list instead of every light.
+// The lists live in one Shader Storage Buffer, tile t starts at t * ( lightsPerTile + 1 ): first the
+// number of lights, then their indices into the light buffer.
+// Needs compute shaders and fragment SSBOs, so it only runs when the LightBuffer uses storage.
+class LightCulling
+{
+
+public:
+
+	static constexpr GLuint BINDING = 1;
+	static constexpr uint32_t TILE_SIZE = 16;
+	// Lights past this many in a single tile are dropped, it also sizes the compute shader's shared list.
+	static constexpr uint32_t MAX_LIGHTS_PER_TILE = 1024;
+
+	// lightDefines are the LightBuffer's, the culling shader reads the same light list.
+	void init( uint32_t width, uint32_t height, uint32_t maxLights, const std::string& lightDefines )
+	{
+
+		// No need for room that can never be used.
+		lightsPerTile = std::max<uint32_t>( std::min( maxLights, MAX_LIGHTS_PER_TILE ), 1 );
+
+		// Compiles along with the other programs, finishProgram() once they are all going.
+		shader = new ComputeShader( "lightCulling.comp", lightDefines + defines() );
+
+		GLObjects::genBuffers( 1, &buffer );
+		resize( width, height );
+
+	}
+
+	Shader* program() const
+	{
+
+		return shader;
+
+	}
+
+	// Waits for the culling shader if it isn't done yet, see Shader::finishAll.
+	void finishProgram()
+	{
+
+		shader->finish();
+		shader->use();
+		shader->setInt( "gDepth", 0 );
+		uniformScreenSize = shader->resolveUniform( "screenSize" );
+		uniformInvViewProjection = shader->resolveUniform( "invViewProjection" );
+		uniformLightCount = shader->resolveUniform( "lightCount" );
+
+	}
+
+	// The screen changed size, the lists are re-allocated for its tiles. The lighting shader needs the
+	// new getTilesX().
+	void resize( uint32_t width, uint32_t height )
+	{
+
+		tilesX = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+		tilesY = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+		glBindBuffer( GL_SHADER_STORAGE_BUFFER, buffer );
+		glBufferData( GL_SHADER_STORAGE_BUFFER, ( GLsizeiptr )tilesX * tilesY * ( lightsPerTile + 1 ) * sizeof( GLuint ),
+					  nullptr, GL_DYNAMIC_COPY );
+		glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+
+	}
+
+	// Extra #defines for the culling shader and for every shader that reads the tile lists.
+	std::string defines() const
+	{
+
+		return "#define TILE_SIZE " + std::to_string( TILE_SIZE ) + "\n#define MAX_LIGHTS_PER_TILE " +
+			   std::to_string( lightsPerTile ) + "\n";
+
+	}
+
+	uint32_t getTilesX() const
+	{
+
+		return tilesX;
+
+	}
+
+	// Expects the G-buffer's depth bound to texture unit 0 and this frame's lights already uploaded,
+	// the lists are ready for any shader that runs after this.
+	void dispatch( uint32_t lightCount, uint32_t width, uint32_t height, const glm::mat4& invViewProjection )
+	{
+
+		shader->use();
+		shader->setVec2( uniformScreenSize, glm::vec2( width, height ) );
+		shader->setMat4( uniformInvViewProjection, invViewProjection );
+		shader->setInt( uniformLightCount, ( int )lightCount );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, BINDING, buffer );
+		shader->dispatch( tilesX, tilesY );
+		glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT );
+
+	}
+
+	void free()
+	{
+
+		GLObjects::deleteBuffers( 1, &buffer );
+		if( shader )
+		{
+
+			GLObjects::deleteProgram( shader->ID );
+			delete shader;
+			shader = nullptr;
+
+		}
+
+	}
+
+private:
+
+	ComputeShader* shader = nullptr;
+	GLint uniformScreenSize = -1, uniformLightCount = -1, uniformInvViewProjection = -1;
+
+	GLuint buffer = 0;
+	uint32_t tilesX = 0, tilesY = 0, lightsPerTile = 1;
+
+};
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef MESH_REGISTRY_H
+#define MESH_REGISTRY_H
+
+#include <glad/glad.h>
+
+#include "GLObjects.h"
+#include "GLState.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Static geometry is uploaded once, when it is registered, and only referenced through handles from
+// then on. There is no way to change a mesh after it was created, with GL 4.4 the buffers even get
+// immutable storage, so drawing never allocates or uploads anything.
+
+// Interleaved float attribute, meshes list them in the order they appear in a vertex.
+struct VertexAttribute
+{
+
+	GLuint location;
+	GLint components;
+
+};
+
+class MeshHandle
+{
+
+public:
+
+	MeshHandle() = default;
+
+	bool valid() const
+	{
+
+		return index != INVALID;
+
+	}
+
+private:
+
+	friend class MeshRegistry;
+
+	static constexpr uint32_t INVALID = 0xFFFFFFFF;
+	uint32_t index = INVALID;
+
+	explicit MeshHandle( uint32_t index ) : index( index ) {}
+
+};
+
+class MeshRegistry
+{
+
+public:
+
+	// Indices are optional, without them the vertices are drawn in order.
+	MeshHandle create( const std::vector<GLfloat>& vertices, const std::vector<VertexAttribute>& layout,
+					   const std::vector<GLuint>& indices = {}, GLenum mode = GL_TRIANGLES )
+	{
+
+		Mesh mesh;
+		mesh.mode = mode;
+		mesh.layout = layout;
+		for( const VertexAttribute& attribute : layout )
+		{
+
+			mesh.stride += attribute.components * ( GLsizei )sizeof( GLfloat );
+
+		}
+
+		if( mesh.stride == 0 || vertices.size() * sizeof( GLfloat ) % mesh.stride != 0 )
+		{
+
+			throw std::runtime_error( "Mesh vertices don't match their layout!" );
+
+		}
+
+		mesh.indexed = !indices.empty();
+		mesh.count = mesh.indexed ? ( GLsizei )indices.size() : ( GLsizei )( vertices.size() * sizeof( GLfloat ) / mesh.stride );
+
+		GLObjects::genVertexArrays( 1, &mesh.vertexArrayObject );
+		GLObjects::genBuffers( 1, &mesh.vertexBufferObject );
+		GLState::bindVertexArray( mesh.vertexArrayObject );
+		upload( GL_ARRAY_BUFFER, mesh.vertexBufferObject, vertices.size() * sizeof( GLfloat ), vertices.data() );
+
+		if( mesh.indexed )
+		{
+
+			// The element buffer binding is part of the VAO, it has to be bound while the VAO is.
+			GLObjects::genBuffers( 1, &mesh.elementBufferObject );
+			upload( GL_ELEMENT_ARRAY_BUFFER, mesh.elementBufferObject, indices.size() * sizeof( GLuint ), indices.data() );
+
+		}
+
+		bindAttributes( mesh );
+		GLState::bindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+		meshes.push_back( mesh );
+		return MeshHandle( ( uint32_t )meshes.size() - 1 );
+
+	}
+
+	void draw( MeshHandle handle ) const
+	{
+
+		const Mesh& mesh = get( handle );
+		GLState::bindVertexArray( mesh.vertexArrayObject );
+		submit( mesh, 1 );
+
+	}
+
+	// Draws the mesh's vertices through another VAO, one that adds per instance attributes on top of
+	// the ones bindAttributes set up.
+	void drawInstanced( MeshHandle handle, GLuint vertexArrayObject, GLsizei instances, GLuint baseInstance = 0 ) const
+	{
+
+		GLState::bindVertexArray( vertexArrayObject );
+		submit( get( handle ), instances, baseInstance );
+
+	}
+
+	// Points the currently bound VAO at the mesh's buffers with the mesh's layout.
+	void bindAttributes( MeshHandle handle ) const
+	{
+
+		const Mesh& mesh = get( handle );
+		bindAttributes( mesh );
+		if( mesh.indexed )
+		{
+
+			glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mesh.elementBufferObject );
+
+		}
+
+	}
+
+	void free()
+	{
+
+		for( Mesh& mesh : meshes )
+		{
+
+			GLObjects::deleteBuffers( 1, &mesh.vertexBufferObject );
+			GLObjects::deleteBuffers( 1, &mesh.elementBufferObject );
+			GLObjects::deleteVertexArrays( 1, &mesh.vertexArrayObject );
+
+		}
+		meshes.clear();
+
+	}
+
+private:
+
+	struct Mesh
+	{
+
+		GLuint vertexArrayObject = 0, vertexBufferObject = 0, elementBufferObject = 0;
+		std::vector<VertexAttribute> layout;
+		GLsizei stride = 0, count = 0;
+		GLenum mode = GL_TRIANGLES;
+		bool indexed = false;
+
+	};
+
+	std::vector<Mesh> meshes;
+
+	const Mesh& get( MeshHandle handle ) const
+	{
+
+		if( handle.index >= meshes.size() )
+		{
+
+			throw std::runtime_error( "Invalid mesh handle!" );
+
+		}
+		return meshes[ handle.index ];
+
+	}
+
+	static void upload( GLenum target, GLuint buffer, GLsizeiptr size, const void* data )
+	{
+
+		glBindBuffer( target, buffer );
+		if( GLAD_GL_VERSION_4_4 )
+		{
+
+			glBufferStorage( target, size, data, 0 );
+
+		}
+
+		else
+		{
+
+			glBufferData( target, size, data, GL_STATIC_DRAW );
+
+		}
+
+	}
+
+	static void bindAttributes( const Mesh& mesh )
+	{
+
+		glBindBuffer( GL_ARRAY_BUFFER, mesh.vertexBufferObject );
+		size_t offset = 0;
+		for( const VertexAttribute& attribute : mesh.layout )
+		{
+
+			glVertexAttribPointer( attribute.location, attribute.components, GL_FLOAT, GL_FALSE, mesh.stride,
+								   ( void* )offset );
+			glEnableVertexAttribArray( attribute.location );
+			offset += attribute.components * sizeof( GLfloat );
+
+		}
+
+	}
+
+	// baseInstance skips that many entries of the per instance attributes, so several views can share
+	// one instance buffer.
+	static void submit( const Mesh& mesh, GLsizei instances, GLuint baseInstance = 0 )
+	{
+
+		if( mesh.indexed )
+		{
+
+			glDrawElementsInstancedBaseInstance( mesh.mode, mesh.count, GL_UNSIGNED_INT, 0, instances, baseInstance );
+
+		}
+
+		else
+		{
+
+			glDrawArraysInstancedBaseInstance( mesh.mode, 0, mesh.count, instances, baseInstance );
+
+		}
+
+	}
+
+};
+
+#endif
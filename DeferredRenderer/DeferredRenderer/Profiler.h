@@ -0,0 +1,439 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include "GLObjects.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+
+// Per pass CPU and GPU timings. Every pass is wrapped in a GL_TIME_ELAPSED query, the queries are
+// double-buffered: we only read back a frame's results once we are about to reuse its queries, two
+// frames later, by then the GPU is done with them and the CPU never has to wait. Fragment counts
+// (GL_SAMPLES_PASSED) come back the same way.
+
+// The passes we time, keep PASS_NAMES in the same order.
+enum RenderPass
+{
+
+	PASS_SHADOW = 0,
+	PASS_SHADOW_ATLAS,
+	PASS_DEPTH_PREPASS,
+	PASS_GBUFFER,
+	PASS_DECALS,
+	PASS_SHADOW_MASK,
+	PASS_LIGHT_CULLING,
+	PASS_LIGHTING,
+	PASS_UPSCALE,
+	PASS_FORWARD,
+	PASS_COUNT
+
+};
+
+static const char* PASS_NAMES[ PASS_COUNT ] = { "shadow", "atlas", "prepass", "gbuffer", "decals", "shadowmask", "culling", "lighting", "upscale", "forward" };
+
+// Per frame numbers that are not times but explain them, like how many objects each view drew. Keep
+// COUNTER_NAMES in the same order.
+enum RenderCounter
+{
+
+	COUNTER_CAMERA_DRAWN = 0,
+	COUNTER_CAMERA_CULLED,
+	COUNTER_SHADOW_DRAWN,
+	COUNTER_SHADOW_CULLED,
+	// Cascades whose cached still casters had to be drawn again.
+	COUNTER_SHADOW_REFRESHED,
+	// Point lights that got tiles in the shadow atlas, and the objects drawn into all of their faces.
+	COUNTER_ATLAS_LIGHTS,
+	COUNTER_ATLAS_DRAWN,
+	// Fragments the G-buffer pass shaded, pixels that ended up covered by geometry and the first over the
+	// second: how many times every covered pixel got shaded, 1 is no overdraw at all.
+	COUNTER_GBUFFER_FRAGMENTS,
+	COUNTER_COVERED_PIXELS,
+	COUNTER_OVERDRAW,
+	// The dynamic resolution's scale the frame rendered at, 1 is the output's size.
+	COUNTER_RESOLUTION_SCALE,
+	// Megabytes of render targets alive at the same time at worst during the frame, and what the pool
+	// holds on to in total.
+	COUNTER_TARGETS_PEAK_MB,
+	COUNTER_TARGETS_MB,
+	// How long the job system took to prepare the frame, it overlaps with the previous frame's passes.
+	COUNTER_PREPARE_MS,
+	// Program, texture, sampler and vertex array binds that reached GL, and the ones GLState dropped
+	// because they wouldn't have changed anything.
+	COUNTER_BINDS,
+	COUNTER_REDUNDANT_BINDS,
+	// Lighting and light volume programs compiled so far, a new one means a frame needed a new variant.
+	COUNTER_SHADER_VARIANTS,
+	// Kilobytes of texture data the streamer handed to GL, and the textures still not fully resident.
+	COUNTER_STREAM_KB,
+	COUNTER_STREAMING_TEXTURES,
+	COUNTER_COUNT
+
+};
+
+static const char* COUNTER_NAMES[ COUNTER_COUNT ] = { "camera_drawn", "camera_culled", "shadow_drawn", "shadow_culled",
+															  "shadow_refreshed", "atlas_lights", "atlas_drawn",
+															  "gbuffer_fragments", "covered_pixels", "overdraw", "resolution_scale", "targets_peak_mb",
+															  "targets_mb", "prepare_ms", "binds", "redundant_binds", "shader_variants",
+															  "stream_kb", "streaming_textures" };
+
+// One frame's worth of resolved timings, in milliseconds.
+struct FrameTimings
+{
+
+	uint64_t frame = 0;
+	bool recorded[ PASS_COUNT ] = {};
+	double cpuMs[ PASS_COUNT ] = {};
+	double gpuMs[ PASS_COUNT ] = {};
+	double counters[ COUNTER_COUNT ] = {};
+	bool counted[ COUNTER_COUNT ] = {};
+
+};
+
+class Profiler
+{
+
+public:
+
+	// Number of frames whose queries can be in flight.
+	static constexpr uint16_t QUERY_BUFFERS = 2;
+	// How many frames the rolling statistics look at.
+	static constexpr uint16_t WINDOW = 240;
+
+	// Called whenever a frame's results come back, the benchmark uses it to keep every sample.
+	std::function<void( const FrameTimings& )> onResolved;
+
+	void init()
+	{
+
+		GLObjects::genQueries( QUERY_BUFFERS * PASS_COUNT, &queries[ 0 ][ 0 ] );
+		GLObjects::genQueries( QUERY_BUFFERS * COUNTER_COUNT, &fragmentQueries[ 0 ][ 0 ] );
+
+	}
+
+	void beginFrame()
+	{
+
+		// Whatever is still pending in this slot is from QUERY_BUFFERS frames ago.
+		FrameSlot& slot = slots[ frameIndex % QUERY_BUFFERS ];
+		if( slot.pending )
+		{
+
+			resolve( frameIndex % QUERY_BUFFERS, false );
+
+		}
+
+		slot.pending = true;
+		slot.timings = FrameTimings();
+		slot.timings.frame = frameIndex;
+
+	}
+
+	void endFrame()
+	{
+
+		++frameIndex;
+
+	}
+
+	// Passes can't overlap, GL_TIME_ELAPSED queries can't be nested.
+	void beginPass( RenderPass pass )
+	{
+
+		uint16_t buffer = frameIndex % QUERY_BUFFERS;
+		current = pass;
+		slots[ buffer ].timings.recorded[ pass ] = true;
+		glBeginQuery( GL_TIME_ELAPSED, queries[ buffer ][ pass ] );
+		passStart = std::chrono::high_resolution_clock::now();
+
+	}
+
+	// The CPU time is the time it took us to record the pass' commands, not the time the driver took
+	// to execute them, that is what the GPU time is for.
+	void endPass()
+	{
+
+		auto now = std::chrono::high_resolution_clock::now();
+		slots[ frameIndex % QUERY_BUFFERS ].timings.cpuMs[ current ] =
+			std::chrono::duration<double, std::milli>( now - passStart ).count();
+		glEndQuery( GL_TIME_ELAPSED );
+
+	}
+
+	// Counters are known on the CPU right away, they just travel with the frame's timings.
+	void setCounter( RenderCounter counter, double value )
+	{
+
+		slots[ frameIndex % QUERY_BUFFERS ].timings.counters[ counter ] = value;
+
+	}
+
+	// The samples that pass every test and aren't discarded until endFragments() end up in counter, with
+	// the rest of the frame's results. Can't be nested, but can run inside a pass.
+	void beginFragments( RenderCounter counter )
+	{
+
+		uint16_t buffer = frameIndex % QUERY_BUFFERS;
+		slots[ buffer ].timings.counted[ counter ] = true;
+		glBeginQuery( GL_SAMPLES_PASSED, fragmentQueries[ buffer ][ counter ] );
+
+	}
+
+	void endFragments()
+	{
+
+		glEndQuery( GL_SAMPLES_PASSED );
+
+	}
+
+	// The newest frame whose results came back, frame is UINT64_MAX until there is one.
+	const FrameTimings& latest() const
+	{
+
+		return last;
+
+	}
+
+	// Blocks until every outstanding query is back, only meant for the end of a run.
+	void flush()
+	{
+
+		// Oldest first, frameIndex already points past the last frame we recorded.
+		for( uint16_t i = 0; i < QUERY_BUFFERS; ++i )
+		{
+
+			uint16_t buffer = ( frameIndex + i ) % QUERY_BUFFERS;
+			if( slots[ buffer ].pending )
+			{
+
+				resolve( buffer, true );
+
+			}
+
+		}
+
+	}
+
+	// Rolling min/avg/p99 for every pass over the last WINDOW resolved frames.
+	void dump( std::ostream& out ) const
+	{
+
+		out << "Profiler: last " << std::min<uint64_t>( resolvedCount, WINDOW ) << " frames, "
+			<< droppedCount << " dropped (times in ms)\n";
+		out << std::left << std::setw( 10 ) << "pass"
+			<< std::right << std::setw( 11 ) << "cpu min" << std::setw( 11 ) << "cpu avg" << std::setw( 11 ) << "cpu p99"
+			<< std::setw( 11 ) << "gpu min" << std::setw( 11 ) << "gpu avg" << std::setw( 11 ) << "gpu p99" << "\n";
+		out << std::fixed << std::setprecision( 3 );
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			Stats cpu = stats( cpuHistory[ i ] ), gpu = stats( gpuHistory[ i ] );
+			out << std::left << std::setw( 10 ) << PASS_NAMES[ i ] << std::right
+				<< std::setw( 11 ) << cpu.min << std::setw( 11 ) << cpu.avg << std::setw( 11 ) << cpu.p99
+				<< std::setw( 11 ) << gpu.min << std::setw( 11 ) << gpu.avg << std::setw( 11 ) << gpu.p99 << "\n";
+
+		}
+		out << std::left << std::setw( 14 ) << "counter"
+			<< std::right << std::setw( 11 ) << "min" << std::setw( 11 ) << "avg" << std::setw( 11 ) << "p99" << "\n";
+		out << std::setprecision( 1 );
+		for( uint16_t i = 0; i < COUNTER_COUNT; ++i )
+		{
+
+			Stats counter = stats( counterHistory[ i ] );
+			out << std::left << std::setw( 14 ) << COUNTER_NAMES[ i ] << std::right
+				<< std::setw( 11 ) << counter.min << std::setw( 11 ) << counter.avg << std::setw( 11 ) << counter.p99 << "\n";
+
+		}
+		out << std::defaultfloat;
+
+	}
+
+	void free()
+	{
+
+		GLObjects::deleteQueries( QUERY_BUFFERS * PASS_COUNT, &queries[ 0 ][ 0 ] );
+		GLObjects::deleteQueries( QUERY_BUFFERS * COUNTER_COUNT, &fragmentQueries[ 0 ][ 0 ] );
+
+	}
+
+private:
+
+	struct FrameSlot
+	{
+
+		bool pending = false;
+		FrameTimings timings;
+
+	};
+
+	struct Stats
+	{
+
+		double min = 0.0, avg = 0.0, p99 = 0.0;
+
+	};
+
+	// Fixed size ring, no allocations once the profiler is up.
+	struct History
+	{
+
+		double samples[ WINDOW ] = {};
+		uint16_t count = 0, next = 0;
+
+		void push( double value )
+		{
+
+			samples[ next ] = value;
+			next = ( next + 1 ) % WINDOW;
+			count = std::min<uint16_t>( count + 1, WINDOW );
+
+		}
+
+	};
+
+	GLuint queries[ QUERY_BUFFERS ][ PASS_COUNT ];
+	GLuint fragmentQueries[ QUERY_BUFFERS ][ COUNTER_COUNT ];
+	FrameSlot slots[ QUERY_BUFFERS ];
+	History cpuHistory[ PASS_COUNT ], gpuHistory[ PASS_COUNT ];
+	History counterHistory[ COUNTER_COUNT ];
+
+	FrameTimings last = unresolved();
+	uint64_t frameIndex = 0, resolvedCount = 0, droppedCount = 0;
+	RenderPass current = PASS_SHADOW;
+	std::chrono::high_resolution_clock::time_point passStart;
+
+	void resolve( uint16_t buffer, bool wait )
+	{
+
+		FrameSlot& slot = slots[ buffer ];
+		slot.pending = false;
+
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			if( !slot.timings.recorded[ i ] )
+			{
+
+				continue;
+
+			}
+
+			// If the GPU is more than QUERY_BUFFERS frames behind we'd rather lose the sample than stall.
+			GLint available = GL_TRUE;
+			if( !wait )
+			{
+
+				glGetQueryObjectiv( queries[ buffer ][ i ], GL_QUERY_RESULT_AVAILABLE, &available );
+
+			}
+
+			if( !available )
+			{
+
+				++droppedCount;
+				return;
+
+			}
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v( queries[ buffer ][ i ], GL_QUERY_RESULT, &elapsed );
+			slot.timings.gpuMs[ i ] = elapsed / 1.0e6;
+
+		}
+
+		// The fragment counts were issued before the last timer query ended, they are back too.
+		for( uint16_t i = 0; i < COUNTER_COUNT; ++i )
+		{
+
+			if( slot.timings.counted[ i ] )
+			{
+
+				GLuint64 samples = 0;
+				glGetQueryObjectui64v( fragmentQueries[ buffer ][ i ], GL_QUERY_RESULT, &samples );
+				slot.timings.counters[ i ] = ( double )samples;
+
+			}
+
+		}
+		double covered = slot.timings.counters[ COUNTER_COVERED_PIXELS ];
+		slot.timings.counters[ COUNTER_OVERDRAW ] = covered > 0.0 ? slot.timings.counters[ COUNTER_GBUFFER_FRAGMENTS ] / covered : 0.0;
+
+		for( uint16_t i = 0; i < PASS_COUNT; ++i )
+		{
+
+			if( slot.timings.recorded[ i ] )
+			{
+
+				cpuHistory[ i ].push( slot.timings.cpuMs[ i ] );
+				gpuHistory[ i ].push( slot.timings.gpuMs[ i ] );
+
+			}
+
+		}
+
+		for( uint16_t i = 0; i < COUNTER_COUNT; ++i )
+		{
+
+			counterHistory[ i ].push( slot.timings.counters[ i ] );
+
+		}
+
+		++resolvedCount;
+		last = slot.timings;
+		if( onResolved )
+		{
+
+			onResolved( slot.timings );
+
+		}
+
+	}
+
+	static FrameTimings unresolved()
+	{
+
+		FrameTimings timings;
+		timings.frame = UINT64_MAX;
+		return timings;
+
+	}
+
+	static Stats stats( const History& history )
+	{
+
+		Stats result;
+		if( history.count == 0 )
+		{
+
+			return result;
+
+		}
+
+		double sorted[ WINDOW ];
+		std::copy( history.samples, history.samples + history.count, sorted );
+		std::sort( sorted, sorted + history.count );
+
+		double sum = 0.0;
+		for( uint16_t i = 0; i < history.count; ++i )
+		{
+
+			sum += sorted[ i ];
+
+		}
+
+		result.min = sorted[ 0 ];
+		result.avg = sum / history.count;
+		result.p99 = sorted[ ( size_t )( 0.99 * ( history.count - 1 ) ) ];
+		return result;
+
+	}
+
+};
+
+#endif
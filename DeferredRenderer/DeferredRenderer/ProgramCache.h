@@ -0,0 +1,283 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// KHR_parallel_shader_compile isn't part of the core profile glad gives us, the ARB version shares its enum.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Linked programs on disk, so a launch after the first one skips GLSL compilation altogether. Every
+// program is keyed by a hash of its stages' final sources (defines included) and of the driver's vendor,
+// renderer and version strings: editing a shader, changing a define or updating the driver is a miss,
+// and the miss compiles from source and replaces the file. A binary the driver refuses is a miss too.
+// Misses compile on the driver's own threads when it has KHR_parallel_shader_compile, Shader only asks
+// whether a program is done instead of waiting for it (see Shader::finishAll).
+
+// One stage of a program, its type and its source with the defines already in.
+using ShaderStage = std::pair<GLenum, std::string>;
+
+class ProgramCache
+{
+
+public:
+
+	// After the context is current. An empty directory turns the cache off, every program compiles.
+	static void init( const std::string& cacheDirectory, GLADloadproc load )
+	{
+
+		directory = cacheDirectory;
+		GLint formats = 0;
+		glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+		// Nothing to retrieve a program as, nowhere to cache it.
+		if( formats <= 0 )
+		{
+
+			directory.clear();
+
+		}
+
+		if( !directory.empty() )
+		{
+
+			std::error_code error;
+			std::filesystem::create_directories( directory, error );
+
+		}
+
+		driver = std::string( ( const char* )glGetString( GL_VENDOR ) ) + "\n" + ( const char* )glGetString( GL_RENDERER ) +
+				 "\n" + ( const char* )glGetString( GL_VERSION );
+
+		// Let the driver use as many threads as it likes.
+		typedef void ( APIENTRY* MaxCompilerThreads )( GLuint count );
+		const char* threadsFunction = hasExtension( "GL_KHR_parallel_shader_compile" ) ? "glMaxShaderCompilerThreadsKHR" :
+									  hasExtension( "GL_ARB_parallel_shader_compile" ) ? "glMaxShaderCompilerThreadsARB" : nullptr;
+		MaxCompilerThreads maxCompilerThreads = threadsFunction ? ( MaxCompilerThreads )load( threadsFunction ) : nullptr;
+		parallel = threadsFunction != nullptr;
+		if( maxCompilerThreads )
+		{
+
+			maxCompilerThreads( 0xFFFFFFFF );
+
+		}
+
+	}
+
+	static bool enabled()
+	{
+
+		return !directory.empty();
+
+	}
+
+	static bool parallelCompile()
+	{
+
+		return parallel;
+
+	}
+
+	// FNV-1a over the driver and every stage, the same program on the same driver always gets the same key.
+	static uint64_t key( const std::vector<ShaderStage>& stages )
+	{
+
+		uint64_t hash = 14695981039346656037ull;
+		hashBytes( hash, driver.data(), driver.size() );
+		for( const ShaderStage& stage : stages )
+		{
+
+			hashBytes( hash, &stage.first, sizeof( stage.first ) );
+			hashBytes( hash, stage.second.data(), stage.second.size() );
+
+		}
+		return hash;
+
+	}
+
+	// Links the program from its cached binary, false when there is none or the driver refused it.
+	static bool load( GLuint program, uint64_t key )
+	{
+
+		bool linked = enabled() && loadBinary( program, key );
+		++( linked ? cached : compiled );
+		return linked;
+
+	}
+
+	// Call before linking a program that is going to be stored.
+	static void retrievable( GLuint program )
+	{
+
+		if( enabled() )
+		{
+
+			glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
+		}
+
+	}
+
+	// Writes a linked program's binary, replacing whatever was there under that key.
+	static void store( GLuint program, uint64_t key )
+	{
+
+		GLint length = 0;
+		if( enabled() )
+		{
+
+			glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+
+		}
+
+		if( length <= 0 )
+		{
+
+			return;
+
+		}
+
+		Header header = {};
+		std::memcpy( header.magic, MAGIC, sizeof( header.magic ) );
+		header.key = key;
+		std::vector<char> binary( length );
+		GLsizei written = 0;
+		glGetProgramBinary( program, length, &written, &header.format, binary.data() );
+		header.length = ( uint32_t )written;
+
+		// Through a temporary file, a launch that dies halfway never leaves half a binary behind.
+		std::string target = path( key ), temporary = target + ".tmp";
+		{
+
+			std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+			file.write( ( const char* )&header, sizeof( header ) );
+			file.write( binary.data(), written );
+			if( !file )
+			{
+
+				return;
+
+			}
+
+		}
+		std::error_code error;
+		std::filesystem::rename( temporary, target, error );
+
+	}
+
+	// Programs linked from the cache and programs that had to be compiled, since the start.
+	static uint32_t cachedPrograms()
+	{
+
+		return cached;
+
+	}
+
+	static uint32_t compiledPrograms()
+	{
+
+		return compiled;
+
+	}
+
+private:
+
+	static constexpr char MAGIC[4] = { 'D', 'R', 'P', 'B' };
+
+	struct Header
+	{
+
+		char magic[4];
+		GLenum format;
+		uint64_t key;
+		uint32_t length;
+
+	};
+
+	static inline std::string directory, driver;
+	static inline bool parallel = false;
+	static inline uint32_t cached = 0, compiled = 0;
+
+	static bool loadBinary( GLuint program, uint64_t key )
+	{
+
+		std::ifstream file( path( key ), std::ios::binary );
+		Header header = {};
+		if( !file.read( ( char* )&header, sizeof( header ) ) || std::memcmp( header.magic, MAGIC, sizeof( header.magic ) ) != 0 ||
+			header.key != key )
+		{
+
+			return false;
+
+		}
+
+		std::vector<char> binary( header.length );
+		if( !file.read( binary.data(), binary.size() ) )
+		{
+
+			return false;
+
+		}
+
+		glProgramBinary( program, header.format, binary.data(), ( GLsizei )binary.size() );
+		GLint linked = GL_FALSE;
+		glGetProgramiv( program, GL_LINK_STATUS, &linked );
+		return linked == GL_TRUE;
+
+	}
+
+	static void hashBytes( uint64_t& hash, const void* data, size_t size )
+	{
+
+		const unsigned char* bytes = ( const unsigned char* )data;
+		for( size_t i = 0; i < size; ++i )
+		{
+
+			hash = ( hash ^ bytes[i] ) * 1099511628211ull;
+
+		}
+
+	}
+
+	static std::string path( uint64_t key )
+	{
+
+		std::ostringstream name;
+		name << std::hex << std::setw( 16 ) << std::setfill( '0' ) << key << ".bin";
+		return ( std::filesystem::path( directory ) / name.str() ).string();
+
+	}
+
+	static bool hasExtension( const char* name )
+	{
+
+		GLint count = 0;
+		glGetIntegerv( GL_NUM_EXTENSIONS, &count );
+		for( GLint i = 0; i < count; ++i )
+		{
+
+			if( std::strcmp( ( const char* )glGetStringi( GL_EXTENSIONS, ( GLuint )i ), name ) == 0 )
+			{
+
+				return true;
+
+			}
+
+		}
+		return false;
+
+	}
+
+};
+
+#endif
@@ -0,0 +1,619 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "Profiler.h"
+#include "RenderTargetPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The frame as a list of passes that say what they read and write, instead of passes that bind, clear,
+// acquire and release by hand in just the right order. compile() works out once per graph:
+// - which passes matter, a pass none of whose writes lead to an output is dropped,
+// - how long every transient target lives, the first pass using it acquires it from the pool and it goes
+//   back after the last one, passes that never overlap end up sharing memory,
+// - which attachments get cleared, only the first write of the frame clears and only when the pass
+//   doesn't cover every pixel anyway.
+// execute() then binds every pass' framebuffer and viewport, skipping both when the previous pass left
+// the same ones bound, binds the textures it samples and runs it. Passes without attachments (shadow
+// maps, compute, blits) bind whatever they need themselves, the graph assumes nothing after them.
+// Transient targets are all as big as the render size, imported resources (the output, the shadow maps,
+// the light tiles) are owned elsewhere and only carry the dependencies.
+
+using RenderResource = uint32_t;
+
+// How much of an attachment a pass writes, one that writes every pixel never needs clearing first.
+enum class Coverage
+{
+
+	Partial,
+	Full
+
+};
+
+class RenderGraph
+{
+
+public:
+
+	static constexpr RenderResource NONE = UINT32_MAX;
+	static constexpr uint32_t MAX_COLOURS = 4;
+
+	class Pass
+	{
+
+	public:
+
+		// A target the pass samples, the graph binds it to unit.
+		Pass& sample( RenderResource resource, GLuint unit )
+		{
+
+			samples.push_back( { resource, unit } );
+			return read( resource );
+
+		}
+
+		// Anything else the pass needs written before it runs.
+		Pass& read( RenderResource resource )
+		{
+
+			reads.push_back( resource );
+			return *this;
+
+		}
+
+		// What the pass writes other than its attachments: a shadow map, a buffer, a blit's destination.
+		Pass& write( RenderResource resource )
+		{
+
+			writes.push_back( resource );
+			return *this;
+
+		}
+
+		// The colour attachments in draw buffer order, an imported framebuffer has to be the only one.
+		Pass& colour( RenderResource resource, Coverage coverage = Coverage::Partial )
+		{
+
+			if( colourCount == MAX_COLOURS )
+			{
+
+				throw std::runtime_error( "Too many colour attachments in render pass " + name + "!" );
+
+			}
+			colours[ colourCount ] = resource;
+			colourCoverage[ colourCount++ ] = coverage;
+			return write( resource );
+
+		}
+
+		Pass& depth( RenderResource resource, Coverage coverage = Coverage::Partial )
+		{
+
+			depthTarget = resource;
+			depthCoverage = coverage;
+			return write( resource );
+
+		}
+
+	private:
+
+		friend class RenderGraph;
+
+		struct Sample
+		{
+
+			RenderResource resource;
+			GLuint unit;
+
+		};
+
+		// Which buffer a clear goes to, the depth's draw buffer is always 0.
+		struct Clear
+		{
+
+			GLenum buffer;
+			GLint drawBuffer;
+
+		};
+
+		std::string name;
+		RenderPass timer = PASS_COUNT;
+		std::function<void()> run;
+		std::vector<Sample> samples;
+		std::vector<RenderResource> reads, writes;
+		RenderResource colours[ MAX_COLOURS ];
+		Coverage colourCoverage[ MAX_COLOURS ];
+		uint32_t colourCount = 0;
+		RenderResource depthTarget = NONE;
+		Coverage depthCoverage = Coverage::Partial;
+
+		// What compile() worked out.
+		bool culled = false;
+		std::vector<RenderResource> acquires, releases;
+		std::vector<Clear> clears;
+
+		bool hasAttachments() const
+		{
+
+			return colourCount > 0 || depthTarget != NONE;
+
+		}
+
+	};
+
+	void init( RenderTargetPool* targetPool, Profiler* frameProfiler )
+	{
+
+		pool = targetPool;
+		profiler = frameProfiler;
+
+	}
+
+	// Forgets every pass and resource, to declare the graph again.
+	void reset()
+	{
+
+		passes.clear();
+		resources.clear();
+		compiled = false;
+
+	}
+
+	// A render size target that only lives for the passes that use it.
+	RenderResource createTarget( const char* name, GLenum format, bool attachmentOnly = false )
+	{
+
+		Resource resource;
+		resource.name = name;
+		resource.kind = Resource::TARGET;
+		resource.desc.format = format;
+		resource.desc.attachmentOnly = attachmentOnly;
+		return add( resource );
+
+	}
+
+	// Owned elsewhere and kept between frames, the graph only orders the passes around it.
+	RenderResource importResource( const char* name )
+	{
+
+		Resource resource;
+		resource.name = name;
+		resource.kind = Resource::IMPORTED;
+		return add( resource );
+
+	}
+
+	// A framebuffer owned elsewhere that passes attach as their only colour attachment, its colour, depth
+	// and stencil all get cleared together. setFramebuffer() says which one and how big every frame.
+	RenderResource importFramebuffer( const char* name )
+	{
+
+		Resource resource;
+		resource.name = name;
+		resource.kind = Resource::FRAMEBUFFER;
+		return add( resource );
+
+	}
+
+	// The graph's results, whatever leads to them is kept.
+	void markOutput( RenderResource resource )
+	{
+
+		resources.at( resource ).output = true;
+
+	}
+
+	// Passes run in the order they are added, the execute function finds its targets through target().
+	Pass& addPass( const char* name, RenderPass timer, std::function<void()> execute )
+	{
+
+		passes.emplace_back();
+		Pass& pass = passes.back();
+		pass.name = name;
+		pass.timer = timer;
+		pass.run = std::move( execute );
+		compiled = false;
+		return pass;
+
+	}
+
+	void compile()
+	{
+
+		// Backwards from the outputs: a pass is needed when something needed reads what it writes.
+		std::vector<bool> needed( resources.size(), false );
+		for( RenderResource i = 0; i < resources.size(); ++i )
+		{
+
+			needed[i] = resources[i].output;
+
+		}
+
+		for( size_t i = passes.size(); i-- > 0; )
+		{
+
+			Pass& pass = passes[i];
+			pass.culled = true;
+			for( RenderResource resource : pass.writes )
+			{
+
+				pass.culled = pass.culled && !needed.at( resource );
+
+			}
+
+			if( !pass.culled )
+			{
+
+				for( RenderResource resource : pass.reads )
+				{
+
+					needed.at( resource ) = true;
+
+				}
+
+			}
+
+		}
+
+		// Forwards through what's left: lifetimes, clears and reads of targets nothing wrote yet.
+		std::vector<bool> written( resources.size(), false );
+		std::vector<size_t> first( resources.size(), SIZE_MAX ), last( resources.size(), SIZE_MAX );
+		for( size_t i = 0; i < passes.size(); ++i )
+		{
+
+			Pass& pass = passes[i];
+			pass.acquires.clear();
+			pass.releases.clear();
+			pass.clears.clear();
+			if( pass.culled )
+			{
+
+				continue;
+
+			}
+
+			for( RenderResource resource : pass.reads )
+			{
+
+				if( resources[ resource ].kind == Resource::TARGET && !written[ resource ] )
+				{
+
+					throw std::runtime_error( "Render pass " + pass.name + " reads " + resources[ resource ].name +
+											  " before anything writes it!" );
+
+				}
+
+			}
+
+			for( uint32_t c = 0; c < pass.colourCount; ++c )
+			{
+
+				RenderResource resource = pass.colours[c];
+				if( resources[ resource ].kind == Resource::FRAMEBUFFER && ( pass.colourCount > 1 || pass.depthTarget != NONE ) )
+				{
+
+					throw std::runtime_error( "Render pass " + pass.name + " can't attach anything next to " +
+											  resources[ resource ].name + "!" );
+
+				}
+
+				if( !written[ resource ] && pass.colourCoverage[c] == Coverage::Partial )
+				{
+
+					pass.clears.push_back( { GL_COLOR, ( GLint )c } );
+					if( resources[ resource ].kind == Resource::FRAMEBUFFER )
+					{
+
+						pass.clears.push_back( { GL_DEPTH_STENCIL, 0 } );
+
+					}
+
+				}
+
+			}
+
+			if( pass.depthTarget != NONE && !written[ pass.depthTarget ] && pass.depthCoverage == Coverage::Partial )
+			{
+
+				GLenum format = resources[ pass.depthTarget ].desc.format;
+				bool stencil = format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+				pass.clears.push_back( { ( GLenum )( stencil ? GL_DEPTH_STENCIL : GL_DEPTH ), 0 } );
+
+			}
+
+			for( RenderResource resource : pass.writes )
+			{
+
+				written[ resource ] = true;
+
+			}
+
+			for( RenderResource resource : pass.reads )
+			{
+
+				use( first, last, resource, i );
+
+			}
+
+			for( RenderResource resource : pass.writes )
+			{
+
+				use( first, last, resource, i );
+
+			}
+
+		}
+
+		for( RenderResource i = 0; i < resources.size(); ++i )
+		{
+
+			if( resources[i].kind == Resource::TARGET && first[i] != SIZE_MAX )
+			{
+
+				passes[ first[i] ].acquires.push_back( i );
+				passes[ last[i] ].releases.push_back( i );
+
+			}
+
+		}
+		compiled = true;
+
+	}
+
+	// How big the transient targets are from now on.
+	void setRenderSize( uint32_t width, uint32_t height )
+	{
+
+		renderWidth = width;
+		renderHeight = height;
+
+	}
+
+	void setFramebuffer( RenderResource resource, GLuint framebuffer, uint32_t width, uint32_t height )
+	{
+
+		Resource& imported = resources.at( resource );
+		imported.framebuffer = framebuffer;
+		imported.width = width;
+		imported.height = height;
+
+	}
+
+	// Runs one frame, the pool's beginFrame() and endFrame() are the caller's.
+	void execute()
+	{
+
+		if( !compiled )
+		{
+
+			compile();
+
+		}
+
+		bool bound = false;
+		GLuint framebuffer = 0;
+		uint32_t width = 0, height = 0;
+		for( Pass& pass : passes )
+		{
+
+			if( pass.culled )
+			{
+
+				continue;
+
+			}
+
+			for( RenderResource resource : pass.acquires )
+			{
+
+				RenderTargetDesc desc = resources[ resource ].desc;
+				desc.width = renderWidth;
+				desc.height = renderHeight;
+				resources[ resource ].target = pool->acquire( desc );
+
+			}
+
+			if( pass.timer != PASS_COUNT )
+			{
+
+				profiler->beginPass( pass.timer );
+
+			}
+
+			if( pass.hasAttachments() )
+			{
+
+				GLuint wanted;
+				uint32_t wantedWidth, wantedHeight;
+				attachments( pass, wanted, wantedWidth, wantedHeight );
+				if( !bound || wanted != framebuffer )
+				{
+
+					glBindFramebuffer( GL_FRAMEBUFFER, wanted );
+					framebuffer = wanted;
+
+				}
+
+				if( !bound || wantedWidth != width || wantedHeight != height )
+				{
+
+					glViewport( 0, 0, wantedWidth, wantedHeight );
+					width = wantedWidth;
+					height = wantedHeight;
+
+				}
+				bound = true;
+
+				for( const Pass::Clear& clear : pass.clears )
+				{
+
+					if( clear.buffer == GL_COLOR )
+					{
+
+						const GLfloat black[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+						glClearBufferfv( GL_COLOR, clear.drawBuffer, black );
+
+					}
+
+					else if( clear.buffer == GL_DEPTH )
+					{
+
+						const GLfloat one = 1.0f;
+						glClearBufferfv( GL_DEPTH, 0, &one );
+
+					}
+
+					else
+					{
+
+						glClearBufferfi( GL_DEPTH_STENCIL, 0, 1.0f, 0 );
+
+					}
+
+				}
+
+			}
+
+			for( const Pass::Sample& sample : pass.samples )
+			{
+
+				GLState::bindTexture( sample.unit, GL_TEXTURE_2D, resources[ sample.resource ].target.name );
+
+			}
+
+			pass.run();
+
+			if( pass.timer != PASS_COUNT )
+			{
+
+				profiler->endPass();
+
+			}
+
+			// Who knows what it left bound.
+			bound = bound && pass.hasAttachments();
+
+			for( RenderResource resource : pass.releases )
+			{
+
+				pool->release( resources[ resource ].target );
+
+			}
+
+		}
+
+	}
+
+	// A transient target as its passes see it, only while one of them runs.
+	const RenderTarget& target( RenderResource resource ) const
+	{
+
+		return resources.at( resource ).target;
+
+	}
+
+	// Passes compile() kept.
+	uint32_t livePasses() const
+	{
+
+		uint32_t live = 0;
+		for( const Pass& pass : passes )
+		{
+
+			live += pass.culled ? 0 : 1;
+
+		}
+		return live;
+
+	}
+
+private:
+
+	struct Resource
+	{
+
+		enum Kind
+		{
+
+			TARGET,
+			IMPORTED,
+			FRAMEBUFFER
+
+		};
+
+		std::string name;
+		Kind kind = TARGET;
+		bool output = false;
+		// The format and usage, the size comes from setRenderSize(). The target is only valid between
+		// the first and the last pass using it.
+		RenderTargetDesc desc;
+		RenderTarget target;
+		GLuint framebuffer = 0;
+		uint32_t width = 0, height = 0;
+
+	};
+
+	RenderTargetPool* pool = nullptr;
+	Profiler* profiler = nullptr;
+	std::vector<Pass> passes;
+	std::vector<Resource> resources;
+	bool compiled = false;
+	uint32_t renderWidth = 0, renderHeight = 0;
+
+	RenderResource add( const Resource& resource )
+	{
+
+		resources.push_back( resource );
+		compiled = false;
+		return ( RenderResource )( resources.size() - 1 );
+
+	}
+
+	static void use( std::vector<size_t>& first, std::vector<size_t>& last, RenderResource resource, size_t pass )
+	{
+
+		first[ resource ] = std::min( first[ resource ], pass );
+		last[ resource ] = last[ resource ] == SIZE_MAX ? pass : std::max( last[ resource ], pass );
+
+	}
+
+	// The framebuffer a pass draws to and its size, the pool's for transient targets.
+	void attachments( const Pass& pass, GLuint& framebuffer, uint32_t& width, uint32_t& height ) const
+	{
+
+		if( pass.colourCount == 1 && resources[ pass.colours[0] ].kind == Resource::FRAMEBUFFER )
+		{
+
+			const Resource& imported = resources[ pass.colours[0] ];
+			framebuffer = imported.framebuffer;
+			width = imported.width;
+			height = imported.height;
+			return;
+
+		}
+
+		RenderTarget colours[ MAX_COLOURS ];
+		for( uint32_t i = 0; i < pass.colourCount; ++i )
+		{
+
+			colours[i] = resources[ pass.colours[i] ].target;
+
+		}
+		RenderTarget depth = pass.depthTarget != NONE ? resources[ pass.depthTarget ].target : RenderTarget();
+		framebuffer = pool->framebuffer( colours, pass.colourCount, depth );
+		width = renderWidth;
+		height = renderHeight;
+
+	}
+
+};
+
+#endif
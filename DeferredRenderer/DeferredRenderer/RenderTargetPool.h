@@ -0,0 +1,470 @@
+#ifndef RENDER_TARGET_POOL_H
+#define RENDER_TARGET_POOL_H
+
+#include <glad/glad.h>
+
+#include "GLObjects.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+// Screen sized targets that only live for part of a frame. Passes acquire what they write and release it
+// once the last pass that reads it is done, the next acquire with the same size, format and usage gets the
+// same texture back instead of a new one. Two passes whose targets are never alive at the same time end
+// up sharing the memory, and a target nothing asked for this frame (another lighting mode, no upscale)
+// isn't allocated at all. Targets that go unused for a few frames are given back to the driver, so a
+// resize or a lighting mode switch doesn't leave the old ones behind.
+// Framebuffers are cached per set of attachments, the same targets coming back get the same framebuffer.
+
+struct RenderTargetDesc
+{
+
+	uint32_t width = 0, height = 0;
+	// A sized internal format, it also says how many bytes the target takes.
+	GLenum format = GL_RGBA8;
+	// Only ever an attachment, a renderbuffer nothing can sample.
+	bool attachmentOnly = false;
+
+	bool operator==( const RenderTargetDesc& other ) const
+	{
+
+		return width == other.width && height == other.height && format == other.format &&
+			   attachmentOnly == other.attachmentOnly;
+
+	}
+
+};
+
+struct RenderTarget
+{
+
+	// A texture, or a renderbuffer when desc.attachmentOnly.
+	GLuint name = 0;
+	RenderTargetDesc desc;
+
+};
+
+class RenderTargetPool
+{
+
+public:
+
+	// Frames a released target waits for another acquire before the pool deletes it.
+	static constexpr uint32_t KEEP_FRAMES = 3;
+
+	// Starts the frame's peak over, everything from last frame should have been released.
+	void beginFrame()
+	{
+
+		++frame;
+		peak = inUse;
+
+	}
+
+	RenderTarget acquire( const RenderTargetDesc& desc )
+	{
+
+		for( Entry& entry : entries )
+		{
+
+			if( !entry.inUse && entry.target.desc == desc )
+			{
+
+				return use( entry );
+
+			}
+
+		}
+
+		Entry entry;
+		entry.target.desc = desc;
+		entry.bytes = ( uint64_t )desc.width * desc.height * bytesPerPixel( desc.format );
+		if( desc.attachmentOnly )
+		{
+
+			GLObjects::genRenderbuffers( 1, &entry.target.name );
+			glBindRenderbuffer( GL_RENDERBUFFER, entry.target.name );
+			glRenderbufferStorage( GL_RENDERBUFFER, desc.format, desc.width, desc.height );
+			glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+		}
+
+		else
+		{
+
+			// Immutable storage, the size and format can never change under the framebuffers using it.
+			GLObjects::genTextures( 1, &entry.target.name );
+			GLState::bindTexture( GL_TEXTURE_2D, entry.target.name );
+			glTexStorage2D( GL_TEXTURE_2D, 1, desc.format, desc.width, desc.height );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+			GLState::bindTexture( GL_TEXTURE_2D, 0 );
+
+		}
+		allocated += entry.bytes;
+		entries.push_back( entry );
+		return use( entries.back() );
+
+	}
+
+	// Once the last pass reading it has been submitted, the GPU keeps the order so the next pass writing
+	// it can't get ahead of the reads.
+	void release( RenderTarget& target )
+	{
+
+		for( Entry& entry : entries )
+		{
+
+			if( entry.inUse && sameTarget( entry.target, target ) )
+			{
+
+				entry.inUse = false;
+				inUse -= entry.bytes;
+				break;
+
+			}
+
+		}
+		target = RenderTarget();
+
+	}
+
+	// A framebuffer with these colour attachments (in order, they are also the draw buffers) and
+	// optionally a depth or depth/stencil one, pass an empty target for none.
+	GLuint framebuffer( std::initializer_list<RenderTarget> colours, const RenderTarget& depth )
+	{
+
+		return framebuffer( colours.begin(), ( uint32_t )colours.size(), depth );
+
+	}
+
+	GLuint framebuffer( const RenderTarget* colours, uint32_t colourCount, const RenderTarget& depth )
+	{
+
+		if( colourCount > MAX_COLOURS )
+		{
+
+			throw std::runtime_error( "Too many render target colour attachments!" );
+
+		}
+
+		Framebuffer wanted;
+		for( uint32_t i = 0; i < colourCount; ++i )
+		{
+
+			wanted.colours[ wanted.colourCount++ ] = colours[i];
+
+		}
+		wanted.depth = depth;
+
+		for( const Framebuffer& cached : framebuffers )
+		{
+
+			if( sameAttachments( cached, wanted ) )
+			{
+
+				return cached.name;
+
+			}
+
+		}
+
+		GLObjects::genFramebuffers( 1, &wanted.name );
+		glBindFramebuffer( GL_FRAMEBUFFER, wanted.name );
+		GLenum drawBuffers[ MAX_COLOURS ];
+		for( uint32_t i = 0; i < wanted.colourCount; ++i )
+		{
+
+			attach( GL_COLOR_ATTACHMENT0 + i, wanted.colours[i] );
+			drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+
+		}
+		glDrawBuffers( wanted.colourCount, drawBuffers );
+		// Depth only, some drivers still want the read buffer to exist.
+		if( wanted.colourCount == 0 )
+		{
+
+			glReadBuffer( GL_NONE );
+
+		}
+		if( depth.name != 0 )
+		{
+
+			attach( hasStencil( depth.desc.format ) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, depth );
+
+		}
+
+		if( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+		{
+
+			throw std::runtime_error( "Render target framebuffer not complete!" );
+
+		}
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		framebuffers.push_back( wanted );
+		return wanted.name;
+
+	}
+
+	// Deletes whatever went unused for KEEP_FRAMES frames, along with the framebuffers it was attached to.
+	void endFrame()
+	{
+
+		for( size_t i = 0; i < entries.size(); )
+		{
+
+			if( !entries[i].inUse && frame - entries[i].lastUsed >= KEEP_FRAMES )
+			{
+
+				destroy( entries[i] );
+				entries[i] = entries.back();
+				entries.pop_back();
+
+			}
+
+			else
+			{
+
+				++i;
+
+			}
+
+		}
+
+	}
+
+	// What every pooled target takes, used or not.
+	uint64_t allocatedBytes() const
+	{
+
+		return allocated;
+
+	}
+
+	// The most that was acquired at the same time since beginFrame().
+	uint64_t peakBytes() const
+	{
+
+		return peak;
+
+	}
+
+	void free()
+	{
+
+		for( Entry& entry : entries )
+		{
+
+			destroy( entry );
+
+		}
+		entries.clear();
+		inUse = peak = 0;
+
+	}
+
+private:
+
+	static constexpr uint32_t MAX_COLOURS = 4;
+
+	struct Entry
+	{
+
+		RenderTarget target;
+		uint64_t bytes = 0, lastUsed = 0;
+		bool inUse = false;
+
+	};
+
+	struct Framebuffer
+	{
+
+		GLuint name = 0;
+		RenderTarget colours[ MAX_COLOURS ];
+		uint32_t colourCount = 0;
+		RenderTarget depth;
+
+	};
+
+	std::vector<Entry> entries;
+	std::vector<Framebuffer> framebuffers;
+	uint64_t frame = 0, allocated = 0, inUse = 0, peak = 0;
+
+	RenderTarget use( Entry& entry )
+	{
+
+		entry.inUse = true;
+		entry.lastUsed = frame;
+		inUse += entry.bytes;
+		peak = std::max( peak, inUse );
+		return entry.target;
+
+	}
+
+	void destroy( Entry& entry )
+	{
+
+		// Every framebuffer it was attached to goes with it.
+		for( size_t i = 0; i < framebuffers.size(); )
+		{
+
+			if( attached( framebuffers[i], entry.target ) )
+			{
+
+				GLObjects::deleteFramebuffers( 1, &framebuffers[i].name );
+				framebuffers[i] = framebuffers.back();
+				framebuffers.pop_back();
+
+			}
+
+			else
+			{
+
+				++i;
+
+			}
+
+		}
+
+		if( entry.target.desc.attachmentOnly )
+		{
+
+			GLObjects::deleteRenderbuffers( 1, &entry.target.name );
+
+		}
+
+		else
+		{
+
+			GLObjects::deleteTextures( 1, &entry.target.name );
+
+		}
+		allocated -= entry.bytes;
+		if( entry.inUse )
+		{
+
+			inUse -= entry.bytes;
+
+		}
+
+	}
+
+	static void attach( GLenum attachment, const RenderTarget& target )
+	{
+
+		if( target.desc.attachmentOnly )
+		{
+
+			glFramebufferRenderbuffer( GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, target.name );
+
+		}
+
+		else
+		{
+
+			glFramebufferTexture2D( GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, target.name, 0 );
+
+		}
+
+	}
+
+	// Textures and renderbuffers have their own names, a name alone doesn't say which target it is.
+	static bool sameTarget( const RenderTarget& a, const RenderTarget& b )
+	{
+
+		return a.name == b.name && a.desc.attachmentOnly == b.desc.attachmentOnly;
+
+	}
+
+	static bool attached( const Framebuffer& framebuffer, const RenderTarget& target )
+	{
+
+		for( uint32_t i = 0; i < framebuffer.colourCount; ++i )
+		{
+
+			if( sameTarget( framebuffer.colours[i], target ) )
+			{
+
+				return true;
+
+			}
+
+		}
+		return framebuffer.depth.name != 0 && sameTarget( framebuffer.depth, target );
+
+	}
+
+	static bool sameAttachments( const Framebuffer& a, const Framebuffer& b )
+	{
+
+		if( a.colourCount != b.colourCount || !sameTarget( a.depth, b.depth ) )
+		{
+
+			return false;
+
+		}
+
+		for( uint32_t i = 0; i < a.colourCount; ++i )
+		{
+
+			if( !sameTarget( a.colours[i], b.colours[i] ) )
+			{
+
+				return false;
+
+			}
+
+		}
+		return true;
+
+	}
+
+	static bool hasStencil( GLenum format )
+	{
+
+		return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+
+	}
+
+	static uint32_t bytesPerPixel( GLenum format )
+	{
+
+		switch( format )
+		{
+
+		case GL_R8:
+			return 1;
+		case GL_RG8:
+		case GL_R16F:
+			return 2;
+		case GL_RG16:
+		case GL_RG16F:
+		case GL_RGBA8:
+		case GL_R32F:
+		case GL_R11F_G11F_B10F:
+		case GL_DEPTH_COMPONENT24:
+		case GL_DEPTH_COMPONENT32F:
+		case GL_DEPTH24_STENCIL8:
+			return 4;
+		case GL_RGBA16:
+		case GL_RGBA16F:
+		case GL_DEPTH32F_STENCIL8:
+			return 8;
+		case GL_RGBA32F:
+			return 16;
+		default:
+			throw std::runtime_error( "Unknown render target format!" );
+
+		}
+
+	}
+
+};
+
+#endif
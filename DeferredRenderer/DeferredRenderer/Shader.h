@@ -3,11 +3,17 @@
 
 #include <glad/glad.h>
 
+#include "GLObjects.h"
+#include "GLState.h"
+#include "ProgramCache.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <thread>
 #include <iostream>
-#include <stb_image.h>
+#include <unordered_map>
+#include <vector>
 
 // Shader class taken from, there are some functions that are implemented by me: 
 // https://learnopengl.com/code_viewer_gh.php?code=includes/learnopengl/shader_m.h
@@ -16,9 +22,10 @@ class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor reads the stages and starts building the program, finish() before using it. defines (a
+	// block of "#define NAME VALUE" lines) is inserted right after the #version line of both stages
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath)
+	Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -48,151 +55,336 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char* fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-		// vertex shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
-		// fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
-		// shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
-		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
-		// delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-
+		source = prelude + vertexCode + fragmentCode;
+		// 2. link it from the cache or start compiling it, finish() waits for it
+		build({ { GL_VERTEX_SHADER, injectDefines(vertexCode, defines) },
+				{ GL_FRAGMENT_SHADER, injectDefines(fragmentCode, defines) } });
+	}
+	// Compiling only gets started by the constructors, the program can't be used before this returns.
+	// It checks for errors, stores a freshly compiled program in the cache and reflects the uniforms.
+	// ------------------------------------------------------------------------
+	void finish()
+	{
+		if (finished)
+			return;
+		for (size_t i = 0; i < compiling.size(); ++i)
+		{
+			checkCompileErrors(compiling[i], stageNames[i]);
+			glDeleteShader(compiling[i]);
+		}
+		if (!compiling.empty())
+		{
+			checkCompileErrors(ID, "PROGRAM");
+			ProgramCache::store(ID, key);
+			compiling.clear();
+		}
+		reflectUniforms();
+		finished = true;
+	}
+	// Whether finish() would return without waiting on the driver. Without parallel compilation there is
+	// no asking, the driver compiles when we first query the result.
+	// ------------------------------------------------------------------------
+	bool ready() const
+	{
+		if (finished || compiling.empty() || !ProgramCache::parallelCompile())
+			return true;
+		GLint done = GL_FALSE;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+		return done == GL_TRUE;
+	}
+	// Finishes the programs in whatever order the driver's threads get them done, instead of waiting for
+	// each one in turn.
+	// ------------------------------------------------------------------------
+	static void finishAll(const std::vector<Shader*>& shaders)
+	{
+		size_t left = shaders.size();
+		while (left > 0)
+		{
+			left = 0;
+			for (Shader* shader : shaders)
+			{
+				if (shader->finished)
+					continue;
+				if (shader->ready())
+					shader->finish();
+				else
+					++left;
+			}
+			if (left > 0)
+				std::this_thread::yield();
+		}
+	}
+	// Reads the declarations every stage shares (prelude.glsl), injectDefines() puts them after the
+	// defines. Has to happen before the first program is created.
+	// ------------------------------------------------------------------------
+	static void loadPrelude(const char* path)
+	{
+		std::ifstream preludeFile;
+		preludeFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			preludeFile.open(path);
+			std::stringstream preludeStream;
+			preludeStream << preludeFile.rdbuf();
+			preludeFile.close();
+			prelude = preludeStream.str() + "\n";
+		}
+		catch (std::ifstream::failure& e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use() const
 	{
-		glUseProgram(ID);
+		GLState::useProgram(ID);
+	}
+	// uniform locations
+	// ------------------------------------------------------------------------
+	// Looks the location up in the table we built at link time, no driver round trip. Names that are
+	// not active in the program give -1, glUniform* silently ignores that location, same as before.
+	// Hot loops should call this once and keep the handle around instead of passing strings.
+	GLint getUniform(const std::string& name) const
+	{
+		auto it = uniforms.find(name);
+		return it != uniforms.end() ? it->second : -1;
+	}
+	// Same lookup for a handle fetched once at init, a name that doesn't appear anywhere in the program's
+	// source can only be a typo (unlike a uniform the compiler removed) and gets reported.
+	// ------------------------------------------------------------------------
+	GLint resolveUniform(const std::string& name) const
+	{
+		GLint location = getUniform(name);
+		if (location == -1 && !mentions(name))
+			std::cout << "ERROR::SHADER::UNKNOWN_UNIFORM " << name << std::endl;
+		return location;
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
 	void setBool(const std::string& name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setBool(getUniform(name), value);
+	}
+	void setBool(GLint location, bool value) const
+	{
+		glUniform1i(location, (int)value);
 	}
 	// ------------------------------------------------------------------------
 	void setInt(const std::string& name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		setInt(getUniform(name), value);
+	}
+	void setInt(GLint location, int value) const
+	{
+		glUniform1i(location, value);
 	}
 	// ------------------------------------------------------------------------
 	void setFloat(const std::string& name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		setFloat(getUniform(name), value);
+	}
+	void setFloat(GLint location, float value) const
+	{
+		glUniform1f(location, value);
 	}
 	// ------------------------------------------------------------------------
 	void setVec2(const std::string& name, const glm::vec2& value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec2(getUniform(name), value);
+	}
+	void setVec2(GLint location, const glm::vec2& value) const
+	{
+		glUniform2fv(location, 1, &value[0]);
 	}
 	void setVec2(const std::string& name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(getUniform(name), x, y);
 	}
 	// ------------------------------------------------------------------------
 	void setVec3(const std::string& name, const glm::vec3& value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec3(getUniform(name), value);
+	}
+	void setVec3(GLint location, const glm::vec3& value) const
+	{
+		glUniform3fv(location, 1, &value[0]);
 	}
 	void setVec3(const std::string& name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(getUniform(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
 	void setVec4(const std::string& name, const glm::vec4& value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec4(getUniform(name), value);
+	}
+	void setVec4(GLint location, const glm::vec4& value) const
+	{
+		glUniform4fv(location, 1, &value[0]);
 	}
 	void setVec4(const std::string& name, float x, float y, float z, float w) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(getUniform(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
 	void setMat2(const std::string& name, const glm::mat2& mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(getUniform(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat3(const std::string& name, const glm::mat3& mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(getUniform(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat4(const std::string& name, const glm::mat4& mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat4(getUniform(name), mat);
 	}
-
-	void createTexture(unsigned int* texture, std::string fileName, std::string samplerName,
-		int uniform
-	)
+	void setMat4(GLint location, const glm::mat4& mat) const
 	{
+		glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+	}
+	// Uploads count consecutive elements of a plain (non struct) array in one call, the location must
+	// be the one of the first element we want to write.
+	// ------------------------------------------------------------------------
+	void setFloatArray(GLint location, const float* values, GLsizei count) const
+	{
+		glUniform1fv(location, count, values);
+	}
+	void setVec3Array(GLint location, const glm::vec3* values, GLsizei count) const
+	{
+		glUniform3fv(location, count, &values[0][0]);
+	}
+	void setMat4Array(GLint location, const glm::mat4* values, GLsizei count) const
+	{
+		glUniformMatrix4fv(location, count, GL_FALSE, &values[0][0][0]);
+	}
 
-		glGenTextures(1, texture);
-		glBindTexture(GL_TEXTURE_2D, *texture);
-
-		// In an ideal world this should be exposed as input params to the function.
-		// Texture wrapping params.
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		// Texture filtering params.
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		// Load image, texture creating and generation of mipmaps.
-		int width, height, channels;
-		stbi_set_flip_vertically_on_load(true); // Yes... I am talking to you Vulkan!
+protected:
+	// for derived programs (ComputeShader) that build ID themselves
+	Shader() : ID(0) {}
 
-		unsigned char* data = stbi_load(fileName.c_str(), &width, &height, &channels, 0);
-		// Get the texture format automatically.
-		auto format = GL_RGB;
-		if (channels == 4)
+	// Links the program from its cached binary when there is one, otherwise compiles and links the
+	// stages without asking for the result, so the driver can work on several programs at once.
+	// ------------------------------------------------------------------------
+	void build(const std::vector<ShaderStage>& stages)
+	{
+		ID = GLObjects::createProgram();
+		key = ProgramCache::key(stages);
+		if (ProgramCache::load(ID, key))
+			return;
+		for (const ShaderStage& stage : stages)
 		{
+			const char* code = stage.second.c_str();
+			unsigned int shader = glCreateShader(stage.first);
+			glShaderSource(shader, 1, &code, NULL);
+			glCompileShader(shader);
+			glAttachShader(ID, shader);
+			compiling.push_back(shader);
+			stageNames.push_back(stage.first == GL_VERTEX_SHADER ? "VERTEX" : stage.first == GL_FRAGMENT_SHADER ? "FRAGMENT" : "COMPUTE");
+		}
+		ProgramCache::retrievable(ID);
+		glLinkProgram(ID);
+	}
 
-			format = GL_RGBA;
+	// #version has to stay the very first statement so the defines go on the line after it, followed by
+	// the prelude so its #ifdefs see them.
+	// ------------------------------------------------------------------------
+	static std::string injectDefines(const std::string& code, const std::string& defines)
+	{
+		std::string header = defines + prelude;
+		if (header.empty())
+			return code;
+		size_t version = code.find("#version");
+		size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return header + code;
+		return code.substr(0, lineEnd + 1) + header + code.substr(lineEnd + 1);
+	}
 
-		}
+	// See loadPrelude().
+	static inline std::string prelude;
 
-		if (data)
-		{
+	// The stages still compiling and what to call them in errors, empty once finished or when the program
+	// came from the cache.
+	std::vector<unsigned int> compiling;
+	std::vector<std::string> stageNames;
+	uint64_t key = 0;
+	bool finished = false;
 
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-			glGenerateMipmap(GL_TEXTURE_2D);
+	// Every active uniform's location, filled once at link time.
+	std::unordered_map<std::string, GLint> uniforms;
+	// Every stage's code as it was read, only kept to check names against.
+	std::string source;
 
+	// Whether every identifier in name ("lights[3].Radius" has two, the index doesn't count) is a whole
+	// word somewhere in the source.
+	// ------------------------------------------------------------------------
+	bool mentions(const std::string& name) const
+	{
+		for (size_t begin = 0; begin < name.size();)
+		{
+			size_t end = begin;
+			while (end < name.size() && isIdentifier(name[end]))
+				++end;
+			if (end > begin && !(name[begin] >= '0' && name[begin] <= '9') && !mentionsWord(name.substr(begin, end - begin)))
+				return false;
+			begin = end + 1;
 		}
-
-		else
+		return true;
+	}
+	bool mentionsWord(const std::string& word) const
+	{
+		for (size_t at = source.find(word); at != std::string::npos; at = source.find(word, at + 1))
 		{
-
-			throw std::runtime_error("Failed to load texture!");
-
+			size_t after = at + word.size();
+			if ((at == 0 || !isIdentifier(source[at - 1])) && (after == source.size() || !isIdentifier(source[after])))
+				return true;
 		}
+		return false;
+	}
+	static bool isIdentifier(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+	}
 
-		// Clear the data.
-		stbi_image_free(data);
-
-		// Bind the uniform sampler.
-		this->use();
-		this->setInt(samplerName, uniform);
-
+	// Walks the program's active uniforms. Arrays are reported once as "name[0]", so we also register
+	// "name" and every "name[i]" to be able to resolve any element without asking the driver later.
+	// Arrays of structs are already reported one member at a time ("lights[3].Radius").
+	// ------------------------------------------------------------------------
+	void reflectUniforms()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> nameBuffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, (GLuint)i, maxLength, &length, &size, &type, nameBuffer.data());
+			std::string name(nameBuffer.data(), length);
+			GLint location = glGetUniformLocation(ID, name.c_str());
+			// Members of uniform blocks don't have a location.
+			if (location == -1)
+				continue;
+			uniforms[name] = location;
+			if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				std::string base = name.substr(0, name.size() - 3);
+				uniforms[base] = location;
+				for (GLint element = 1; element < size; ++element)
+				{
+					std::string elementName = base + "[" + std::to_string(element) + "]";
+					uniforms[elementName] = glGetUniformLocation(ID, elementName.c_str());
+				}
+			}
+		}
 	}
 
-private:
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,133 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <glad/glad.h>
+
+#include "GLObjects.h"
+#include "Shader.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// One shader source, many programs: every combination of feature bits the caller asks for becomes its own
+// program, specialized with #defines so it carries no branch for a feature that is off. A variant is only
+// compiled the first time it is asked for and kept from then on, after the first launch it comes from the
+// ProgramCache anyway. Each variant keeps its own copy of the caller's uniform locations, they are not the
+// same from one program to the next.
+
+template<typename Uniforms>
+class ShaderPermutations
+{
+
+public:
+
+	struct Variant
+	{
+
+		Shader* shader = nullptr;
+		Uniforms uniforms = {};
+		// The uniforms are resolved and the constant ones set.
+		bool ready = false;
+
+	};
+
+	// defines turns a feature mask into #define lines. setup runs once per variant as soon as it's linked,
+	// with it bound: it sets whatever never changes and resolves the uniform locations.
+	void init( const char* vertex, const char* fragment, std::function<std::string( uint32_t )> featureDefines,
+			   std::function<void( Shader&, Uniforms& )> variantSetup )
+	{
+
+		vertexPath = vertex;
+		fragmentPath = fragment;
+		defines = std::move( featureDefines );
+		setup = std::move( variantSetup );
+
+	}
+
+	// Starts compiling a variant without waiting for it, for the ones needed right away: finish them
+	// with Shader::finishAll, get() does the rest.
+	Shader* prepare( uint32_t features )
+	{
+
+		Variant& variant = variants[ features ];
+		if( !variant.shader )
+		{
+
+			variant.shader = new Shader( vertexPath.c_str(), fragmentPath.c_str(), defines( features ) );
+
+		}
+		return variant.shader;
+
+	}
+
+	// The variant for these features, a variant we never needed before gets compiled now.
+	Variant& get( uint32_t features )
+	{
+
+		prepare( features );
+		Variant& variant = variants[ features ];
+		if( !variant.ready )
+		{
+
+			variant.shader->finish();
+			variant.shader->use();
+			setup( *variant.shader, variant.uniforms );
+			variant.ready = true;
+
+		}
+		return variant;
+
+	}
+
+	// Every variant we have so far, for uniforms that change between frames but not every frame.
+	void forEach( const std::function<void( Shader&, Uniforms& )>& function )
+	{
+
+		for( auto& entry : variants )
+		{
+
+			if( entry.second.ready )
+			{
+
+				entry.second.shader->use();
+				function( *entry.second.shader, entry.second.uniforms );
+
+			}
+
+		}
+
+	}
+
+	uint32_t size() const
+	{
+
+		return ( uint32_t )variants.size();
+
+	}
+
+	void free()
+	{
+
+		for( auto& entry : variants )
+		{
+
+			GLObjects::deleteProgram( entry.second.shader->ID );
+			delete entry.second.shader;
+
+		}
+		variants.clear();
+
+	}
+
+private:
+
+	std::string vertexPath, fragmentPath;
+	std::function<std::string( uint32_t )> defines;
+	std::function<void( Shader&, Uniforms& )> setup;
+	std::unordered_map<uint32_t, Variant> variants;
+
+};
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLObjects.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// Shadows for the point lights. They all share one big depth texture, every shadowed light gets six
+// square tiles in it, one per cube face, sized by how much of the screen the light covers. The tiles are
+// handed out again every frame, the lights move every frame anyway so their faces are drawn again no
+// matter what, and the atlas never grows: with more lights than fit the tiles get smaller and, past the
+// smallest, the least important lights go without shadows.
+// The tiles are powers of two handed out biggest first, walking the atlas in Z order. That is a quadtree
+// where every tile takes the first free node of its size: a tile never straddles two nodes and there are
+// no holes until the atlas is full.
+
+struct ShadowAtlasSettings
+{
+
+	// The atlas is size x size, 2048 x 2048 takes 16MB whatever the number of lights.
+	uint32_t size = 2048;
+	// How many point lights can cast shadows at once, the ones that cover most of the screen win.
+	uint32_t lights = 16;
+	// Tile sizes for one cube face, powers of two.
+	uint32_t minTile = 64, maxTile = 512;
+
+};
+
+// One cube face as the lighting shaders see it, same layout as ShadowView in prelude.glsl (std140).
+struct GpuShadowView
+{
+
+	glm::mat4 viewProjection;
+	// Where the face is in the atlas, offset in xy and size in zw, in texture coordinates.
+	glm::vec4 rect;
+
+};
+
+static_assert( sizeof( GpuShadowView ) == 80, "GpuShadowView must match the ShadowView struct in prelude.glsl" );
+
+// A tile in texels.
+struct AtlasTile
+{
+
+	uint32_t x, y, size;
+
+};
+
+class ShadowAtlas
+{
+
+public:
+
+	static constexpr uint32_t FACES = 6;
+	// Sizes the views' uniform block, 32 * 6 views are 15KB, under the 16KB every driver allows.
+	static constexpr uint32_t MAX_LIGHTS = 32;
+	static constexpr GLuint BINDING = 1;
+
+	void init( const ShadowAtlasSettings& atlasSettings )
+	{
+
+		settings = atlasSettings;
+		if( settings.lights > MAX_LIGHTS )
+		{
+
+			throw std::runtime_error( "At most " + std::to_string( MAX_LIGHTS ) + " lights can cast shadows!" );
+
+		}
+
+		// A small atlas just can't hold the biggest tiles, a face never gets more than the whole atlas.
+		settings.maxTile = std::min( settings.maxTile, settings.size );
+		settings.minTile = std::min( settings.minTile, settings.maxTile );
+		if( !isPowerOfTwo( settings.size ) || !isPowerOfTwo( settings.minTile ) || !isPowerOfTwo( settings.maxTile ) ||
+			settings.minTile > settings.maxTile )
+		{
+
+			throw std::runtime_error( "The shadow atlas and its tiles have to be powers of two!" );
+
+		}
+
+		GLObjects::genTextures( 1, &depthMap );
+		GLState::bindTexture( GL_TEXTURE_2D, depthMap );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, settings.size, settings.size, 0, GL_DEPTH_COMPONENT,
+					  GL_FLOAT, NULL );
+		// Only ever read through the comparison, bilinear PCF for free.
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
+		GLState::bindTexture( GL_TEXTURE_2D, 0 );
+
+		GLObjects::genFramebuffers( 1, &depthFBO );
+		glBindFramebuffer( GL_FRAMEBUFFER, depthFBO );
+		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0 );
+		glDrawBuffer( GL_NONE );
+		glReadBuffer( GL_NONE );
+		if( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+		{
+
+			throw std::runtime_error( "Shadow atlas framebuffer not complete!" );
+
+		}
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+		GLObjects::genBuffers( 1, &viewBuffer );
+		glBindBuffer( GL_UNIFORM_BUFFER, viewBuffer );
+		glBufferData( GL_UNIFORM_BUFFER, MAX_LIGHTS * FACES * sizeof( GpuShadowView ), nullptr, GL_STREAM_DRAW );
+		glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+	}
+
+	// Extra #defines for every shader that reads the atlas.
+	std::string defines() const
+	{
+
+		return "#define MAX_SHADOW_VIEWS " + std::to_string( MAX_LIGHTS * FACES ) + "\n";
+
+	}
+
+	uint32_t maxLights() const
+	{
+
+		return settings.lights;
+
+	}
+
+	// The face size a light covering this many pixels on screen (its sphere's diameter) asks for. Every
+	// face sees a quarter of the sphere, half the diameter is about as many texels as it gets pixels.
+	uint32_t tileSize( float pixels ) const
+	{
+
+		uint32_t size = settings.minTile;
+		while( size < settings.maxTile && size < pixels * 0.5f )
+		{
+
+			size <<= 1;
+
+		}
+		return size;
+
+	}
+
+	// Hands out FACES tiles per light, sizes has what every light asked for, most important light first.
+	// When they don't all fit the biggest tiles are halved first, a light keeps looking fine at half the
+	// resolution while one without shadows doesn't, and once everything is as small as it goes the least
+	// important lights drop out. Returns how many lights got tiles. Only math, the job system calls it.
+	uint32_t pack( const uint32_t* sizes, uint32_t count, AtlasTile* tiles ) const
+	{
+
+		// In minTile x minTile cells along the Z order curve.
+		uint64_t cells = ( uint64_t )( settings.size / settings.minTile ) * ( settings.size / settings.minTile );
+		auto footprint = [ & ]( uint32_t tile ) { return FACES * ( uint64_t )( tile / settings.minTile ) * ( tile / settings.minTile ); };
+		count = std::min( count, settings.lights );
+
+		// A light never gets more than the one before it, so the sizes only go down.
+		uint32_t granted[ MAX_LIGHTS ];
+		uint64_t used = 0;
+		for( uint32_t i = 0; i < count; ++i )
+		{
+
+			granted[i] = std::min( sizes[i], i == 0 ? settings.maxTile : granted[ i - 1 ] );
+			used += footprint( granted[i] );
+
+		}
+
+		while( used > cells && granted[ 0 ] > settings.minTile )
+		{
+
+			uint32_t biggest = granted[ 0 ];
+			for( uint32_t i = 0; i < count && granted[i] == biggest; ++i )
+			{
+
+				used -= footprint( biggest ) - footprint( biggest >> 1 );
+				granted[i] = biggest >> 1;
+
+			}
+
+		}
+
+		while( used > cells )
+		{
+
+			used -= footprint( granted[ --count ] );
+
+		}
+
+		// Sizes only go down, so the cursor is always at the start of a node this size.
+		uint64_t cursor = 0;
+		for( uint32_t i = 0; i < count; ++i )
+		{
+
+			for( uint32_t face = 0; face < FACES; ++face )
+			{
+
+				tiles[ i * FACES + face ] = { compact( cursor ) * settings.minTile, compact( cursor >> 1 ) * settings.minTile, granted[i] };
+				cursor += footprint( granted[i] ) / FACES;
+
+			}
+
+		}
+		return count;
+
+	}
+
+	// The six faces of a point light at position that reaches radius, in the order the shaders expect
+	// (+X, -X, +Y, -Y, +Z, -Z) and written to the view's matrix, the rect comes from the tile.
+	void faces( const glm::vec3& position, float radius, const AtlasTile* faceTiles, GpuShadowView* views ) const
+	{
+
+		static const glm::vec3 directions[ FACES ] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		static const glm::vec3 ups[ FACES ] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+		glm::mat4 projection = glm::perspective( glm::radians( 90.0f ), 1.0f, NEAR_PLANE, std::max( radius, 2.0f * NEAR_PLANE ) );
+		for( uint32_t face = 0; face < FACES; ++face )
+		{
+
+			views[ face ].viewProjection = projection * glm::lookAt( position, position + directions[ face ], ups[ face ] );
+			const AtlasTile& tile = faceTiles[ face ];
+			views[ face ].rect = glm::vec4( tile.x, tile.y, tile.size, tile.size ) / ( float )settings.size;
+
+		}
+
+	}
+
+	// Binds the atlas for drawing and clears all of it, every tile is drawn again each frame.
+	void begin()
+	{
+
+		glBindFramebuffer( GL_FRAMEBUFFER, depthFBO );
+		glViewport( 0, 0, settings.size, settings.size );
+		glClear( GL_DEPTH_BUFFER_BIT );
+
+	}
+
+	void bindTile( const AtlasTile& tile )
+	{
+
+		glViewport( tile.x, tile.y, tile.size, tile.size );
+
+	}
+
+	// This frame's faces for the lighting shaders, orphans last frame's.
+	void upload( const GpuShadowView* views, uint32_t count )
+	{
+
+		glBindBuffer( GL_UNIFORM_BUFFER, viewBuffer );
+		glBufferData( GL_UNIFORM_BUFFER, MAX_LIGHTS * FACES * sizeof( GpuShadowView ), nullptr, GL_STREAM_DRAW );
+		glBufferSubData( GL_UNIFORM_BUFFER, 0, count * sizeof( GpuShadowView ), views );
+		glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+		glBindBufferBase( GL_UNIFORM_BUFFER, BINDING, viewBuffer );
+
+	}
+
+	void bindTexture( GLuint unit )
+	{
+
+		GLState::bindTexture( unit, GL_TEXTURE_2D, depthMap );
+
+	}
+
+	void free()
+	{
+
+		GLObjects::deleteTextures( 1, &depthMap );
+		GLObjects::deleteFramebuffers( 1, &depthFBO );
+		GLObjects::deleteBuffers( 1, &viewBuffer );
+
+	}
+
+private:
+
+	static constexpr float NEAR_PLANE = 0.05f;
+
+	ShadowAtlasSettings settings;
+	GLuint depthFBO = 0, depthMap = 0, viewBuffer = 0;
+
+	static bool isPowerOfTwo( uint32_t value )
+	{
+
+		return value != 0 && ( value & ( value - 1 ) ) == 0;
+
+	}
+
+	// Every other bit of a Z order index, the even ones are x and the odd ones y.
+	static uint32_t compact( uint64_t index )
+	{
+
+		uint32_t result = 0;
+		for( uint32_t bit = 0; bit < 32; ++bit )
+		{
+
+			result |= ( uint32_t )( ( index >> ( 2 * bit ) ) & 1 ) << bit;
+
+		}
+		return result;
+
+	}
+
+};
+
+#endif
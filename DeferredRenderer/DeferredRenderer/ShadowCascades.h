@@ -0,0 +1,446 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLObjects.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// Cascaded shadow maps for the spotlight. The camera's view range is cut into slices along its depth and
+// every slice gets its own projection from the light, one layer each of a depth texture array. A slice
+// close to the camera covers a small area so its texels land small on screen, far slices cover a lot
+// but they are far away too.
+// The light is a spotlight so the cascades are perspective projections from its position, each one
+// narrowed down to the part of the cone that sees its slice, never wider than the whole cone.
+// With the cache on, what never moves gets drawn into a second array that is kept between frames. A layer
+// only draws its still casters again when its projection changes (the camera or the light moved) or one
+// of them moved, every other frame the cached depths get copied over and only the moving casters drawn on
+// top.
+
+struct CascadeSettings
+{
+
+	uint32_t count = 4;
+	// 0 splits the range uniformly, 1 logarithmically, anything in between blends both.
+	// https://developer.nvidia.com/gpugems/gpugems3/part-ii-light-and-shadows/chapter-10-parallel-split-shadow-maps-programmable-gpus
+	float splitLambda = 0.75f;
+	// Every layer is resolution x resolution, 4 x 512 x 512 takes the same memory as one 1024 x 1024 map.
+	uint32_t resolution = 512;
+	// Keep the still casters' depths between frames, costs a second array the same size.
+	bool cache = true;
+
+};
+
+// How the screen space shadow pass filters the cascades.
+enum class ShadowFilter
+{
+
+	// Fixed size kernel.
+	Pcf,
+	// The kernel grows with the distance between the receiver and its blockers.
+	Pcss
+
+};
+
+struct ShadowFilterSettings
+{
+
+	ShadowFilter filter = ShadowFilter::Pcf;
+	// The kernel is ( 2 * radius + 1 )^2 comparisons, every one of them already a bilinear 2x2 PCF.
+	uint32_t pcfRadius = 1;
+	// PCSS only, the light's size in shadow map texture space.
+	float lightSize = 0.01f;
+
+};
+
+// What a perspective projection was made from, the cascades need the pieces back.
+struct PerspectiveParameters
+{
+
+	// No near/far, windows.h defines both as macros.
+	float fovY, aspect, nearPlane, farPlane;
+
+};
+
+class ShadowCascades
+{
+
+public:
+
+	// Sizes the uniform arrays in the shaders that read the cascades.
+	static constexpr uint32_t MAX_CASCADES = 4;
+
+	// The split depths only depend on the camera's near and far planes, they are computed once.
+	void init( const CascadeSettings& settings, const PerspectiveParameters& cameraParameters,
+			   const PerspectiveParameters& lightParameters )
+	{
+
+		if( settings.count == 0 || settings.count > MAX_CASCADES )
+		{
+
+			throw std::runtime_error( "Shadow cascades must be between 1 and " + std::to_string( MAX_CASCADES ) + "!" );
+
+		}
+
+		cascadeCount = settings.count;
+		size = settings.resolution;
+		cached = settings.cache;
+		camera = cameraParameters;
+		light = lightParameters;
+
+		for( uint32_t i = 0; i < cascadeCount; ++i )
+		{
+
+			float p = ( float )( i + 1 ) / cascadeCount;
+			float logarithmic = camera.nearPlane * std::pow( camera.farPlane / camera.nearPlane, p );
+			float uniform = camera.nearPlane + ( camera.farPlane - camera.nearPlane ) * p;
+			splits[i] = settings.splitLambda * logarithmic + ( 1.0f - settings.splitLambda ) * uniform;
+
+		}
+
+		float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		depthMap = depthArray( border );
+		depthFBO = layerFramebuffer( depthMap );
+		if( cached )
+		{
+
+			stillMap = depthArray( border );
+			stillFBO = layerFramebuffer( stillMap );
+
+		}
+		invalidate();
+
+		// Sampler objects override the texture's own parameters, so the same layers can be read with
+		// and without the depth comparison at the same time.
+		GLObjects::genSamplers( 2, samplers );
+		for( GLuint sampler : samplers )
+		{
+
+			glSamplerParameteri( sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER );
+			glSamplerParameteri( sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER );
+			glSamplerParameterfv( sampler, GL_TEXTURE_BORDER_COLOR, border );
+
+		}
+		// Linear filtering on a comparison sampler compares the 2x2 texels around the sample and blends
+		// the results, PCF in hardware.
+		glSamplerParameteri( samplers[ COMPARE ], GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		glSamplerParameteri( samplers[ COMPARE ], GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glSamplerParameteri( samplers[ COMPARE ], GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+		glSamplerParameteri( samplers[ COMPARE ], GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
+		glSamplerParameteri( samplers[ RAW ], GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glSamplerParameteri( samplers[ RAW ], GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+
+	}
+
+	// Extra #defines for every shader that reads the cascades.
+	std::string defines() const
+	{
+
+		return "#define MAX_CASCADES " + std::to_string( MAX_CASCADES ) + "\n";
+
+	}
+
+	// The same plus the filter's, for the screen space shadow pass.
+	std::string defines( const ShadowFilterSettings& filter ) const
+	{
+
+		return defines() + "#define PCF_RADIUS " + std::to_string( filter.pcfRadius ) + "\n" +
+			   ( filter.filter == ShadowFilter::Pcss ? "#define SHADOW_PCSS\n" : "" );
+
+	}
+
+	uint32_t count() const
+	{
+
+		return cascadeCount;
+
+	}
+
+	uint32_t resolution() const
+	{
+
+		return size;
+
+	}
+
+	// The view space depth (positive) where every cascade ends.
+	const float* splitDepths() const
+	{
+
+		return splits;
+
+	}
+
+	GLuint texture() const
+	{
+
+		return depthMap;
+
+	}
+
+	// The window changed shape. The splits only depend on the near and far planes, they stay as they are,
+	// the next fit() covers the new frustum.
+	void setAspect( float aspect )
+	{
+
+		camera.aspect = aspect;
+
+	}
+
+	// One light space matrix per cascade for this camera and light, only math so the job system can
+	// call it. The near plane stays at the light's so casters between the light and the slice still
+	// make it into the layer.
+	void fit( const glm::mat4& view, const glm::mat4& lightView, glm::mat4* lightSpaces ) const
+	{
+
+		glm::mat4 viewToLight = lightView * glm::inverse( view );
+		float tanCamera = std::tan( camera.fovY * 0.5f );
+		float tanLight = std::tan( light.fovY * 0.5f );
+
+		for( uint32_t i = 0; i < cascadeCount; ++i )
+		{
+
+			// The slice's corners in light view space, bit 0 picks the side, bit 1 top or bottom and bit 2
+			// the near or the far end.
+			glm::vec3 corners[8];
+			for( uint32_t corner = 0; corner < 8; ++corner )
+			{
+
+				float depth = corner & 4 ? splits[i] : ( i == 0 ? camera.nearPlane : splits[ i - 1 ] );
+				float h = depth * tanCamera, w = h * camera.aspect;
+				corners[ corner ] = glm::vec3( viewToLight * glm::vec4( corner & 1 ? w : -w, corner & 2 ? h : -h, -depth, 1.0f ) );
+
+			}
+
+			// The camera usually sits close to the light, so slices often reach behind it. Only what is in
+			// front of the light's near plane can be projected: the corners there and the points where the
+			// slice's edges cross the plane. Where they land on the near plane bounds the cascade.
+			glm::vec2 cone( tanLight * light.aspect, tanLight );
+			glm::vec2 low = cone, high = -cone;
+			float farthest = light.nearPlane;
+			auto include = [ & ]( const glm::vec3& p )
+			{
+
+				glm::vec2 slope = glm::vec2( p.x, p.y ) / -p.z;
+				low = glm::min( low, slope );
+				high = glm::max( high, slope );
+				farthest = std::max( farthest, -p.z );
+
+			};
+
+			for( uint32_t corner = 0; corner < 8; ++corner )
+			{
+
+				const glm::vec3& a = corners[ corner ];
+				if( -a.z > light.nearPlane )
+				{
+
+					include( a );
+
+				}
+
+				for( uint32_t axis = 1; axis < 8; axis <<= 1 )
+				{
+
+					const glm::vec3& b = corners[ corner | axis ];
+					if( ( corner & axis ) == 0 && ( -a.z > light.nearPlane ) != ( -b.z > light.nearPlane ) )
+					{
+
+						float t = ( -light.nearPlane - a.z ) / ( b.z - a.z );
+						include( a + ( b - a ) * t );
+
+					}
+
+				}
+
+			}
+
+			low = glm::clamp( low, -cone, cone );
+			high = glm::clamp( high, -cone, cone );
+			// A slice completely outside the cone still needs a valid projection, nothing it sees is lit anyway.
+			high = glm::max( high, low + glm::vec2( 1e-3f ) );
+			farthest = std::min( std::max( farthest, 2.0f * light.nearPlane ), light.farPlane );
+
+			low *= light.nearPlane;
+			high *= light.nearPlane;
+			lightSpaces[i] = glm::frustum( low.x, high.x, low.y, high.y, light.nearPlane, farthest ) * lightView;
+
+		}
+
+	}
+
+	// Whether layer has to draw its still casters again for lightSpace, a layer drawn with a different
+	// projection is no good. Only prepareFrame calls this, and the frames get submitted in the order they
+	// were prepared, so the GL thread finds the cache the way the answer assumed.
+	bool stale( uint32_t layer, const glm::mat4& lightSpace )
+	{
+
+		bool result = !cached || !valid[ layer ] || lightSpace != keys[ layer ];
+		keys[ layer ] = lightSpace;
+		valid[ layer ] = true;
+		return result;
+
+	}
+
+	// A still caster moved, every layer draws them again.
+	void invalidate()
+	{
+
+		std::fill( valid, valid + MAX_CASCADES, false );
+
+	}
+
+	// Binds where layer's still casters get drawn, cleared: the cached layer or, without a cache, the one
+	// the shadow pass reads.
+	void beginStill( uint32_t layer )
+	{
+
+		bindLayer( cached ? stillFBO : depthFBO, cached ? stillMap : depthMap, layer );
+		glClear( GL_DEPTH_BUFFER_BIT );
+
+	}
+
+	// Gets layer ready for its moving casters on top of the still ones, refreshed says whether beginStill
+	// ran for it this frame. False when there is nothing to draw: no moving casters in the layer now nor
+	// in what it holds from last frame, it already is exactly the still depths.
+	bool beginMoving( uint32_t layer, bool refreshed, bool anyMoving )
+	{
+
+		if( cached && ( refreshed || holdsMoving[ layer ] ) )
+		{
+
+			glCopyImageSubData( stillMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+								depthMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, size, size, 1 );
+
+		}
+		holdsMoving[ layer ] = anyMoving;
+
+		if( anyMoving )
+		{
+
+			bindLayer( depthFBO, depthMap, layer );
+
+		}
+		return anyMoving;
+
+	}
+
+	// The layers on compareUnit go through the depth comparison (sampler2DArrayShadow), on depthUnit they
+	// are plain depths (sampler2DArray). The samplers stay bound to the units until unbindTextures().
+	void bindTextures( GLuint compareUnit, GLuint depthUnit )
+	{
+
+		GLuint units[2] = { compareUnit, depthUnit };
+		for( uint32_t i = 0; i < 2; ++i )
+		{
+
+			GLState::bindTexture( units[i], GL_TEXTURE_2D_ARRAY, depthMap );
+			GLState::bindSampler( units[i], samplers[i] );
+
+		}
+
+	}
+
+	void unbindTextures( GLuint compareUnit, GLuint depthUnit )
+	{
+
+		GLState::bindSampler( compareUnit, 0 );
+		GLState::bindSampler( depthUnit, 0 );
+
+	}
+
+	void free()
+	{
+
+		GLObjects::deleteTextures( 1, &depthMap );
+		GLObjects::deleteFramebuffers( 1, &depthFBO );
+		if( cached )
+		{
+
+			GLObjects::deleteTextures( 1, &stillMap );
+			GLObjects::deleteFramebuffers( 1, &stillFBO );
+
+		}
+		GLObjects::deleteSamplers( 2, samplers );
+
+	}
+
+private:
+
+	uint32_t cascadeCount = 0, size = 0;
+	float splits[ MAX_CASCADES ] = {};
+	PerspectiveParameters camera = {}, light = {};
+	GLuint depthFBO = 0, depthMap = 0;
+	// The still casters' depths, only with the cache.
+	GLuint stillFBO = 0, stillMap = 0;
+	bool cached = false;
+	// The projection every cached layer was drawn with, written when the frame is prepared.
+	glm::mat4 keys[ MAX_CASCADES ];
+	bool valid[ MAX_CASCADES ] = {};
+	// Which layers the GL thread last drew moving casters into.
+	bool holdsMoving[ MAX_CASCADES ] = {};
+	// Indexed by COMPARE and RAW.
+	enum { COMPARE = 0, RAW = 1 };
+	GLuint samplers[2] = {};
+
+	GLuint depthArray( const float* border )
+	{
+
+		GLuint texture;
+		GLObjects::genTextures( 1, &texture );
+		GLState::bindTexture( GL_TEXTURE_2D_ARRAY, texture );
+		glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, size, size, cascadeCount, 0, GL_DEPTH_COMPONENT,
+					  GL_FLOAT, NULL );
+		glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER );
+		glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER );
+		glTexParameterfv( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border );
+		GLState::bindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+		return texture;
+
+	}
+
+	// Depth only, bindLayer() picks the layer it writes to.
+	GLuint layerFramebuffer( GLuint texture )
+	{
+
+		GLuint framebuffer;
+		GLObjects::genFramebuffers( 1, &framebuffer );
+		glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+		glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0 );
+		glDrawBuffer( GL_NONE );
+		glReadBuffer( GL_NONE );
+		if( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+		{
+
+			throw std::runtime_error( "Shadow map framebuffer not complete!" );
+
+		}
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		return framebuffer;
+
+	}
+
+	// Renders into texture's layer from now on, with the viewport set to the cascade's size.
+	void bindLayer( GLuint framebuffer, GLuint texture, uint32_t layer )
+	{
+
+		glViewport( 0, 0, size, size );
+		glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+		glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer );
+
+	}
+
+};
+
+#endif
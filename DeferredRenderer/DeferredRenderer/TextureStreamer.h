@@ -0,0 +1,461 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <stb_image.h>
+
+#include "GLObjects.h"
+#include "GLState.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Textures loaded without the render thread ever waiting on them. The workers decode the image and build
+// its mip chain (JobSystem::runBackground), the GL thread then uploads a bit of it every frame through a
+// ring of pixel unpack buffers, the smallest mip first: the whole texture shows up blurry after a few
+// kilobytes and sharpens as the bigger levels land, GL_TEXTURE_BASE_LEVEL hides the ones still missing.
+// Until the smallest level is in, texture() is a 1x1 placeholder of the caller's colour.
+// Every staging buffer gets a fence after its uploads, a buffer whose fence didn't signal yet is skipped
+// for the frame instead of waited on, and the bytes copied per frame are capped by the budget.
+
+class TextureStreamer
+{
+
+public:
+
+	typedef uint32_t Handle;
+
+	// uploadBudget is how many bytes may go to GL every frame, at least a row of the level being uploaded
+	// always does.
+	void init( JobSystem& jobSystem, uint32_t uploadBudget )
+	{
+
+		jobs = &jobSystem;
+		budget = uploadBudget;
+		stbi_set_flip_vertically_on_load( true );
+		GLObjects::genBuffers( STAGING, staging );
+
+	}
+
+	// Starts decoding the image, wrap goes to both axes.
+	Handle load( const std::string& path, const glm::vec4& placeholder, GLenum wrap )
+	{
+
+		textures.push_back( std::unique_ptr<Texture>( new Texture() ) );
+		Texture& texture = *textures.back();
+		texture.path = path;
+		texture.wrap = wrap;
+
+		unsigned char colour[4];
+		for( int i = 0; i < 4; ++i )
+		{
+
+			colour[i] = ( unsigned char )( glm::clamp( placeholder[i], 0.0f, 1.0f ) * 255.0f + 0.5f );
+
+		}
+		GLObjects::genTextures( 1, &texture.placeholder );
+		GLState::bindTexture( GL_TEXTURE_2D, texture.placeholder );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colour );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		GLState::bindTexture( GL_TEXTURE_2D, 0 );
+
+		Texture* decoding = &texture;
+		jobs->runBackground( decodes, [ decoding ]() { decode( *decoding ); } );
+		return ( Handle )textures.size() - 1;
+
+	}
+
+	// What to bind for it this frame.
+	GLuint texture( Handle handle ) const
+	{
+
+		const Texture& texture = *textures[ handle ];
+		return texture.baseLevel >= 0 ? texture.name : texture.placeholder;
+
+	}
+
+	// Once a frame on the GL thread: creates the textures whose image got decoded and uploads what the
+	// budget allows of the missing levels.
+	void update()
+	{
+
+		frameBytes = 0;
+		for( std::unique_ptr<Texture>& texture : textures )
+		{
+
+			if( !texture->name && texture->decoded.load() )
+			{
+
+				allocate( *texture );
+
+			}
+
+		}
+
+		// The GPU still reads this frame's staging buffer, the uploads wait for the next frame.
+		if( !available( slot ) )
+		{
+
+			return;
+
+		}
+
+		std::vector<Copy> copies;
+		size_t staged = plan( copies );
+		if( copies.empty() )
+		{
+
+			return;
+
+		}
+
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, staging[ slot ] );
+		if( staged > stagingSize[ slot ] )
+		{
+
+			stagingSize[ slot ] = std::max<size_t>( staged, budget );
+			glBufferData( GL_PIXEL_UNPACK_BUFFER, stagingSize[ slot ], nullptr, GL_STREAM_DRAW );
+
+		}
+
+		// The fence says the GPU is done with the whole buffer, no need for the driver to synchronize.
+		unsigned char* mapped = ( unsigned char* )glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, staged, GL_MAP_WRITE_BIT |
+									GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+		if( !mapped )
+		{
+
+			glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+			throw std::runtime_error( "Unable to map a texture staging buffer!" );
+
+		}
+
+		for( const Copy& copy : copies )
+		{
+
+			const Level& level = copy.texture->levels[ copy.level ];
+			std::memcpy( mapped + copy.offset, &copy.texture->pixels[ level.offset + ( size_t )copy.y * level.width * 4 ],
+						 ( size_t )copy.rows * level.width * 4 );
+
+		}
+		glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+
+		for( const Copy& copy : copies )
+		{
+
+			Texture& texture = *copy.texture;
+			const Level& level = texture.levels[ copy.level ];
+			GLState::bindTexture( GL_TEXTURE_2D, texture.name );
+			glTexSubImage2D( GL_TEXTURE_2D, copy.level, 0, copy.y, level.width, copy.rows, GL_RGBA, GL_UNSIGNED_BYTE,
+							 ( const void* )( uintptr_t )copy.offset );
+			if( copy.y + copy.rows == level.height )
+			{
+
+				// GL runs the upload before anything we draw after it, the level can be sampled right away.
+				texture.baseLevel = copy.level;
+				glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.baseLevel );
+
+			}
+
+		}
+		GLState::bindTexture( GL_TEXTURE_2D, 0 );
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+		fences[ slot ] = GLObjects::fenceSync();
+		slot = ( slot + 1 ) % STAGING;
+		frameBytes = staged;
+
+		// Fully resident, the image and the placeholder are done with.
+		for( const Copy& copy : copies )
+		{
+
+			Texture& texture = *copy.texture;
+			if( texture.baseLevel == 0 && texture.placeholder )
+			{
+
+				std::vector<unsigned char>().swap( texture.pixels );
+				GLObjects::deleteTextures( 1, &texture.placeholder );
+
+			}
+
+		}
+
+	}
+
+	// Bytes the last update() uploaded.
+	size_t uploadedBytes() const
+	{
+
+		return frameBytes;
+
+	}
+
+	// Textures that are not fully resident yet.
+	uint32_t streaming() const
+	{
+
+		uint32_t count = 0;
+		for( const std::unique_ptr<Texture>& texture : textures )
+		{
+
+			count += texture->baseLevel != 0 ? 1 : 0;
+
+		}
+		return count;
+
+	}
+
+	// After the job system stopped, a decode may still be writing into a texture until then.
+	void free()
+	{
+
+		for( GLsync& fence : fences )
+		{
+
+			GLObjects::deleteSync( fence );
+
+		}
+
+		for( std::unique_ptr<Texture>& texture : textures )
+		{
+
+			GLObjects::deleteTextures( 1, &texture->name );
+			GLObjects::deleteTextures( 1, &texture->placeholder );
+
+		}
+		textures.clear();
+		GLObjects::deleteBuffers( STAGING, staging );
+		std::fill( stagingSize, stagingSize + STAGING, 0 );
+
+	}
+
+private:
+
+	// Staging buffers in flight, one gets filled while the GPU may still read the others.
+	static constexpr uint32_t STAGING = 3;
+
+	struct Level
+	{
+
+		uint32_t width, height;
+		// Where it starts in Texture::pixels.
+		size_t offset;
+
+	};
+
+	struct Texture
+	{
+
+		std::string path;
+		GLenum wrap = GL_REPEAT;
+		GLuint name = 0, placeholder = 0;
+
+		// Written by the decode, only read once decoded is set.
+		std::vector<Level> levels;
+		std::vector<unsigned char> pixels;
+		bool failed = false;
+		std::atomic<bool> decoded{ false };
+
+		// The finest level that can be sampled, -1 before the first one is in, and where the upload is at:
+		// the level being staged (-1 once they all are) and how many of its rows already were.
+		int32_t baseLevel = -1;
+		int32_t uploading = -1;
+		uint32_t uploadedRows = 0;
+
+	};
+
+	// Rows of one level staged this frame at offset in the staging buffer.
+	struct Copy
+	{
+
+		Texture* texture;
+		int32_t level;
+		uint32_t y, rows;
+		size_t offset;
+
+	};
+
+	JobSystem* jobs = nullptr;
+	JobSystem::Group decodes;
+	uint32_t budget = 0;
+	std::vector<std::unique_ptr<Texture>> textures;
+
+	GLuint staging[ STAGING ] = {};
+	size_t stagingSize[ STAGING ] = {};
+	GLsync fences[ STAGING ] = {};
+	uint32_t slot = 0;
+	size_t frameBytes = 0;
+
+	// On a worker: RGBA8 whatever the file has, and every mip down to 1x1 as a 2x2 box filter.
+	static void decode( Texture& texture )
+	{
+
+		int width = 0, height = 0, channels = 0;
+		unsigned char* data = stbi_load( texture.path.c_str(), &width, &height, &channels, 4 );
+		if( !data )
+		{
+
+			texture.failed = true;
+			texture.decoded.store( true );
+			return;
+
+		}
+
+		size_t size = 0;
+		for( uint32_t w = width, h = height;; w = std::max( w / 2, 1u ), h = std::max( h / 2, 1u ) )
+		{
+
+			texture.levels.push_back( { w, h, size } );
+			size += ( size_t )w * h * 4;
+			if( w == 1 && h == 1 )
+			{
+
+				break;
+
+			}
+
+		}
+
+		texture.pixels.resize( size );
+		std::memcpy( texture.pixels.data(), data, ( size_t )width * height * 4 );
+		stbi_image_free( data );
+
+		for( size_t i = 1; i < texture.levels.size(); ++i )
+		{
+
+			const Level& source = texture.levels[ i - 1 ];
+			const Level& level = texture.levels[ i ];
+			const unsigned char* from = &texture.pixels[ source.offset ];
+			unsigned char* to = &texture.pixels[ level.offset ];
+			for( uint32_t y = 0; y < level.height; ++y )
+			{
+
+				// An odd size loses its last row or column, a side of 1 repeats itself.
+				uint32_t y0 = std::min( y * 2, source.height - 1 ), y1 = std::min( y * 2 + 1, source.height - 1 );
+				for( uint32_t x = 0; x < level.width; ++x )
+				{
+
+					uint32_t x0 = std::min( x * 2, source.width - 1 ), x1 = std::min( x * 2 + 1, source.width - 1 );
+					for( uint32_t c = 0; c < 4; ++c )
+					{
+
+						uint32_t sum = from[ ( ( size_t )y0 * source.width + x0 ) * 4 + c ] + from[ ( ( size_t )y0 * source.width + x1 ) * 4 + c ] +
+									   from[ ( ( size_t )y1 * source.width + x0 ) * 4 + c ] + from[ ( ( size_t )y1 * source.width + x1 ) * 4 + c ];
+						to[ ( ( size_t )y * level.width + x ) * 4 + c ] = ( unsigned char )( ( sum + 2 ) / 4 );
+
+					}
+
+				}
+
+			}
+
+		}
+		texture.decoded.store( true );
+
+	}
+
+	// Immutable storage for every level, nothing in any of them yet.
+	void allocate( Texture& texture )
+	{
+
+		if( texture.failed )
+		{
+
+			throw std::runtime_error( "Failed to load texture " + texture.path + "!" );
+
+		}
+
+		int32_t levels = ( int32_t )texture.levels.size();
+		GLObjects::genTextures( 1, &texture.name );
+		GLState::bindTexture( GL_TEXTURE_2D, texture.name );
+		glTexStorage2D( GL_TEXTURE_2D, levels, GL_RGBA8, texture.levels[0].width, texture.levels[0].height );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture.wrap );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture.wrap );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1 );
+		GLState::bindTexture( GL_TEXTURE_2D, 0 );
+		texture.uploading = levels - 1;
+
+	}
+
+	// Picks this frame's rows, coarsest level first and the textures in the order they were asked for,
+	// and returns how many bytes they take.
+	size_t plan( std::vector<Copy>& copies )
+	{
+
+		size_t staged = 0;
+		for( std::unique_ptr<Texture>& pointer : textures )
+		{
+
+			Texture& texture = *pointer;
+			while( texture.uploading >= 0 )
+			{
+
+				const Level& level = texture.levels[ texture.uploading ];
+				size_t rowBytes = ( size_t )level.width * 4;
+				uint32_t rows = ( uint32_t )std::min<size_t>( level.height - texture.uploadedRows,
+															  staged < budget ? ( budget - staged ) / rowBytes : 0 );
+				// A row wider than the budget still goes, alone.
+				rows = staged == 0 ? std::max( rows, 1u ) : rows;
+				if( rows == 0 )
+				{
+
+					return staged;
+
+				}
+
+				copies.push_back( { &texture, texture.uploading, texture.uploadedRows, rows, staged } );
+				staged += rows * rowBytes;
+				texture.uploadedRows += rows;
+				if( texture.uploadedRows == level.height )
+				{
+
+					--texture.uploading;
+					texture.uploadedRows = 0;
+
+				}
+
+			}
+
+		}
+		return staged;
+
+	}
+
+	// Whether the GPU is done with a staging buffer, without waiting for it.
+	bool available( uint32_t index )
+	{
+
+		if( !fences[ index ] )
+		{
+
+			return true;
+
+		}
+
+		GLenum result = glClientWaitSync( fences[ index ], 0, 0 );
+		if( result == GL_TIMEOUT_EXPIRED )
+		{
+
+			return false;
+
+		}
+		GLObjects::deleteSync( fences[ index ] );
+		return true;
+
+	}
+
+};
+
+#endif
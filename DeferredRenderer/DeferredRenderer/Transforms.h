@@ -0,0 +1,262 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "JobSystem.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Every entity's position, rotation and scale, stored structure of arrays (one array per component)
+// so the loops that animate or compose them walk contiguous floats. An entity is just its index, they
+// are created once and never removed.
+// The world matrices are only rebuilt for the entities that changed since the last update(), and they
+// sit next to each other in one array that every pass reads from (it gets uploaded as a whole, see
+// RenderEngine::updateTransforms).
+
+typedef uint32_t Entity;
+
+// Direct access to a range of positions, for entities that move every frame.
+struct PositionSpan
+{
+
+	float* x;
+	float* y;
+	float* z;
+
+};
+
+class TransformSystem
+{
+
+public:
+
+	Entity create( const glm::vec3& position, const glm::vec3& scale = glm::vec3( 1.0f ),
+				   const glm::quat& rotation = glm::quat( 1.0f, 0.0f, 0.0f, 0.0f ) )
+	{
+
+		positionX.push_back( position.x );
+		positionY.push_back( position.y );
+		positionZ.push_back( position.z );
+		scaleX.push_back( scale.x );
+		scaleY.push_back( scale.y );
+		scaleZ.push_back( scale.z );
+		rotationX.push_back( rotation.x );
+		rotationY.push_back( rotation.y );
+		rotationZ.push_back( rotation.z );
+		rotationW.push_back( rotation.w );
+		world.push_back( glm::mat4( 1.0f ) );
+		dirty.push_back( 1 );
+		anyDirty = true;
+		return ( Entity )world.size() - 1;
+
+	}
+
+	uint32_t size() const
+	{
+
+		return ( uint32_t )world.size();
+
+	}
+
+	void setPosition( Entity entity, const glm::vec3& position )
+	{
+
+		positionX[ entity ] = position.x;
+		positionY[ entity ] = position.y;
+		positionZ[ entity ] = position.z;
+		markDirty( entity, 1 );
+
+	}
+
+	void setScale( Entity entity, const glm::vec3& scale )
+	{
+
+		scaleX[ entity ] = scale.x;
+		scaleY[ entity ] = scale.y;
+		scaleZ[ entity ] = scale.z;
+		markDirty( entity, 1 );
+
+	}
+
+	void setRotation( Entity entity, const glm::quat& rotation )
+	{
+
+		rotationX[ entity ] = rotation.x;
+		rotationY[ entity ] = rotation.y;
+		rotationZ[ entity ] = rotation.z;
+		rotationW[ entity ] = rotation.w;
+		markDirty( entity, 1 );
+
+	}
+
+	glm::vec3 position( Entity entity ) const
+	{
+
+		return glm::vec3( positionX[ entity ], positionY[ entity ], positionZ[ entity ] );
+
+	}
+
+	// The whole range is considered changed, write every position in it.
+	PositionSpan editPositions( Entity first, uint32_t count )
+	{
+
+		markDirty( first, count );
+		return { &positionX[ first ], &positionY[ first ], &positionZ[ first ] };
+
+	}
+
+	// Whether anything in the range changed since the last update().
+	bool changed( Entity first, uint32_t count ) const
+	{
+
+		return anyDirty && count != 0 && std::memchr( &dirty[ first ], 1, count ) != nullptr;
+
+	}
+
+	// Rebuilds the world matrices of everything that changed, runs of consecutive dirty entities go
+	// through compose() in one go. With a job system long runs get split over its threads.
+	void update( JobSystem* jobs = nullptr )
+	{
+
+		if( !anyDirty )
+		{
+
+			return;
+
+		}
+
+		uint32_t count = size(), i = 0;
+		while( i < count )
+		{
+
+			if( !dirty[ i ] )
+			{
+
+				++i;
+				continue;
+
+			}
+
+			uint32_t end = i + 1;
+			while( end < count && dirty[ end ] )
+			{
+
+				++end;
+
+			}
+			if( jobs && end - i > PARALLEL_GRAIN )
+			{
+
+				uint32_t first = i;
+				jobs->parallelFor( end - i, PARALLEL_GRAIN,
+								   [ this, first ]( uint32_t begin, uint32_t last ) { compose( first + begin, first + last ); } );
+
+			}
+
+			else
+			{
+
+				compose( i, end );
+
+			}
+			i = end;
+
+		}
+
+		std::memset( dirty.data(), 0, dirty.size() );
+		anyDirty = false;
+
+	}
+
+	const glm::mat4& worldMatrix( Entity entity ) const
+	{
+
+		return world[ entity ];
+
+	}
+
+	const glm::mat4* worldMatrices() const
+	{
+
+		return world.data();
+
+	}
+
+private:
+
+	// Below this many matrices a job costs more than it saves.
+	static constexpr uint32_t PARALLEL_GRAIN = 1024;
+
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> scaleX, scaleY, scaleZ;
+	// Unit quaternions.
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<glm::mat4> world;
+	std::vector<uint8_t> dirty;
+	bool anyDirty = false;
+
+	void markDirty( Entity first, uint32_t count )
+	{
+
+		// An empty range can start one past the end, there is no dirty[ first ] to take the address of.
+		if( count == 0 )
+		{
+
+			return;
+
+		}
+
+		std::memset( &dirty[ first ], 1, count );
+		anyDirty = true;
+
+	}
+
+	// translate * rotate * scale written out by hand, no branches and no calls so the compiler can
+	// vectorize the loop.
+	void compose( uint32_t begin, uint32_t end )
+	{
+
+		const float* px = positionX.data(), * py = positionY.data(), * pz = positionZ.data();
+		const float* sx = scaleX.data(), * sy = scaleY.data(), * sz = scaleZ.data();
+		const float* qx = rotationX.data(), * qy = rotationY.data(), * qz = rotationZ.data(), * qw = rotationW.data();
+		float* m = &world[ 0 ][ 0 ][ 0 ];
+
+		for( uint32_t i = begin; i < end; ++i )
+		{
+
+			float xx = qx[ i ] * qx[ i ], yy = qy[ i ] * qy[ i ], zz = qz[ i ] * qz[ i ];
+			float xy = qx[ i ] * qy[ i ], xz = qx[ i ] * qz[ i ], yz = qy[ i ] * qz[ i ];
+			float wx = qw[ i ] * qx[ i ], wy = qw[ i ] * qy[ i ], wz = qw[ i ] * qz[ i ];
+			float* column = m + ( size_t )i * 16;
+
+			column[ 0 ] = ( 1.0f - 2.0f * ( yy + zz ) ) * sx[ i ];
+			column[ 1 ] = 2.0f * ( xy + wz ) * sx[ i ];
+			column[ 2 ] = 2.0f * ( xz - wy ) * sx[ i ];
+			column[ 3 ] = 0.0f;
+
+			column[ 4 ] = 2.0f * ( xy - wz ) * sy[ i ];
+			column[ 5 ] = ( 1.0f - 2.0f * ( xx + zz ) ) * sy[ i ];
+			column[ 6 ] = 2.0f * ( yz + wx ) * sy[ i ];
+			column[ 7 ] = 0.0f;
+
+			column[ 8 ] = 2.0f * ( xz + wy ) * sz[ i ];
+			column[ 9 ] = 2.0f * ( yz - wx ) * sz[ i ];
+			column[ 10 ] = ( 1.0f - 2.0f * ( xx + yy ) ) * sz[ i ];
+			column[ 11 ] = 0.0f;
+
+			column[ 12 ] = px[ i ];
+			column[ 13 ] = py[ i ];
+			column[ 14 ] = pz[ i ];
+			column[ 15 ] = 1.0f;
+
+		}
+
+	}
+
+};
+
+#endif
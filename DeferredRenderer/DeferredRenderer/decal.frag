@@ -1,92 +1,88 @@
 #version 330 core
-layout (location = 0) out vec3 outGPosition;
-layout (location = 1) out vec4 outGNormal;
-layout (location = 2) out vec4 outGAlbedoSpec;
+// Blends the decal over whatever the G-buffer pass left inside its box, see Decals.h. The G-buffer's
+// normal is what we write to so the surface's normal comes back from the depth instead.
+layout (location = 0) out vec4 outGNormal;
+layout (location = 1) out vec4 outGAlbedoSpec;
 
-// Get our geometry buffer's data.
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
-uniform sampler2D gAlbedoSpec;
+uniform sampler2D gDepth;
+uniform sampler2D decalTexture;
 
-uniform sampler2D texture1;
+uniform mat4 invViewProjection;
 
-uniform vec3 lightColour;
-in vec2 TexCoords;
+flat in mat4 InvModel;
+flat in vec3 Tangent;
+flat in vec3 Up;
+flat in vec3 Bitangent;
 
-in mat4 invView;
-in mat4 invModel;
-in mat4 invProj;
+// How far the texture's brightness bends the normal.
+const float RELIEF = 2.0;
 
-in vec4 clipSpace;
-
-vec4 reconstructPos(float z, vec2 uv_f)
-{
-    vec4 sPos = vec4(uv_f * 2.0 - 1.0, z, 1.0);
-    sPos = invProj * invView * sPos;
-    return vec4((sPos.xyz / sPos.w ), 1.0);
-}
-
-void main()
+// The world position of one pixel of the depth buffer, whatever size it is.
+vec3 worldAt( ivec2 pixel )
 {
 
-	/*vec3 ndcPos = clipSpace.xyz / clipSpace.w;
-	vec2 texCoord = ndcPos.xy * 0.5 + 0.5;
-	float sampleDepth = texture( gPosition, texCoord ).r;
-
-	float sampleNdcZ = sampleDepth * 2.0 - 1.0;
+	ivec2 size = textureSize( gDepth, 0 );
+	pixel = clamp( pixel, ivec2( 0 ), size - 1 );
+	float depth = texelFetch( gDepth, pixel, 0 ).r;
+	vec2 uv = ( vec2( pixel ) + 0.5 ) / vec2( size );
+	vec4 position = invViewProjection * vec4( vec3( uv, depth ) * 2.0 - 1.0, 1.0 );
+	return position.xyz / position.w;
 
-	vec3 ndcSample = vec3( ndcPos.xy, sampleNdcZ );
-	vec4 hViewPos = invProj * vec4( ndcSample, 1.0 );
-	vec3 viewPosition = hViewPos.xyz / hViewPos.w;
-
-	vec3 WorldPos = ( invView * vec4( viewPosition, 1.0 ) ).xyz;
-	vec3 objectPosition = ( invModel * vec4( WorldPos, 1.0 ) ).xyz;
-
-	if (abs(objectPosition.x) > 0.5) discard;    
-	else if (abs(objectPosition.y) > 0.5) discard;    
-	else if (abs(objectPosition.z) > 0.5) discard; 
-
-	outGAlbedoSpec = texture( texture1, texCoord );*/
+}
 
-	vec3 col = vec3( 0 );
+// From the neighbours on the same surface, on either side we take the one closer to this pixel so an
+// edge doesn't bend it.
+vec3 surfaceNormal( ivec2 pixel, vec3 position )
+{
 
-	vec2 screenSpace = clipSpace.xy / clipSpace.w;
+	vec3 right = worldAt( pixel + ivec2( 1, 0 ) ) - position, left = position - worldAt( pixel - ivec2( 1, 0 ) );
+	vec3 up = worldAt( pixel + ivec2( 0, 1 ) ) - position, down = position - worldAt( pixel - ivec2( 0, 1 ) );
+	vec3 dx = dot( right, right ) < dot( left, left ) ? right : left;
+	vec3 dy = dot( up, up ) < dot( down, down ) ? up : down;
+	return normalize( cross( dx, dy ) );
 
-	vec2 depthUv = screenSpace * 0.5 + 0.5;
-	depthUv += vec2( 0.5 / 1200.0, 0.5 / 800.0 );
+}
 
-	float sceneDepth = texture( gPosition, depthUv ).r;
+float luminance( vec3 colour )
+{
 
-	vec4 worldPos = reconstructPos( sceneDepth, depthUv );
-	vec4 localPos = invModel * worldPos;
+	return dot( colour, vec3( 0.299, 0.587, 0.114 ) );
 
-	float dist = 0.5 - abs( localPos.y );
-	float distO = 0.5 - abs( localPos.x );
+}
 
-	vec2 uv = vec2( localPos.x, localPos.y ) + 0.5;
-	vec4 pos = texture( gPosition, uv );
-	vec4 nor = texture( gNormal, uv );
-	vec4 alb = texture( gAlbedoSpec, uv );
-	/*outGPosition = pos.xyz;
-	outGNormal = nor;
-	outGAlbedoSpec = alb;*/
+void main()
+{
 
-	if( dist > 0.0 && dist > 0.0 )
+	ivec2 pixel = ivec2( gl_FragCoord.xy );
+	vec3 position = worldAt( pixel );
+	// The cube mesh goes from -1 to 1.
+	vec3 local = ( InvModel * vec4( position, 1.0 ) ).xyz;
+	vec2 uv = local.xz * 0.5 + 0.5;
+	// The gradients before anything is discarded, a pixel on the edge of the box still gets a mip level.
+	vec2 uvX = dFdx( uv ), uvY = dFdy( uv );
+	if( any( greaterThan( abs( local ), vec3( 1.0 ) ) ) )
 	{
-	
+
 		discard;
 
 	}
 
-	else
-	{
-	
-		outGAlbedoSpec = vec4( 1, 0, 0, 1 );
-	
-	}
-
-	//outGAlbedoSpec = texture( gAlbedoSpec, uv );
-
-	//vec4 texNorm = texture( gNormal, TexCoords );
+	vec3 normal = surfaceNormal( pixel, position );
+	// Surfaces that don't face the projection would get the texture smeared over them, they fade out,
+	// and so does everything close to the box's top and bottom.
+	float facing = clamp( ( dot( normal, Up ) - 0.3 ) / 0.4, 0.0, 1.0 );
+	float edge = clamp( ( 1.0 - abs( local.y ) ) * 4.0, 0.0, 1.0 );
+	vec4 colour = textureGrad( decalTexture, uv, uvX, uvY );
+	float alpha = colour.a * facing * edge;
+
+	// The relief, brightness differences one screen pixel apart along the texture's axes.
+	float step = max( length( uvX ), length( uvY ) );
+	float height = luminance( colour.rgb );
+	float slopeX = luminance( textureGrad( decalTexture, uv + vec2( step, 0.0 ), uvX, uvY ).rgb ) - height;
+	float slopeZ = luminance( textureGrad( decalTexture, uv + vec2( 0.0, step ), uvX, uvY ).rgb ) - height;
+	vec3 bent = normalize( normal - RELIEF * ( slopeX * Tangent + slopeZ * Bitangent ) );
+
+	outGNormal = vec4( encodeNormal( bent ), 0.0, alpha );
+	outGAlbedoSpec = vec4( colour.rgb, alpha );
 
 }
\ No newline at end of file
@@ -1,29 +1,26 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec2 aTexCoords;
+// The back faces of the decal boxes, see Decals.h.
+layout (location = 0) in vec3 aPos;
+// Per decal: the box's world matrix and its inverse, worked out on the CPU.
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in mat4 aInvModel;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+uniform mat4 viewProjection;
 
-out vec2 TexCoords;
-
-out mat4 invProj;
-out mat4 invView;
-out mat4 invModel;
-
-out vec4 clipSpace;
+flat out mat4 InvModel;
+// The box's axes in world space, the texture lies along the first and the last, it gets projected along
+// the second.
+flat out vec3 Tangent;
+flat out vec3 Up;
+flat out vec3 Bitangent;
 
 void main()
 {
 
-	vec4 worldPos = model * vec4( aPos, 1 );
-	TexCoords = aTexCoords;
-	invProj = inverse( projection );
-	invModel = inverse( model );
-	invView = inverse( view );
-	gl_Position = projection * view * worldPos;
-	clipSpace = gl_Position;
+	InvModel = aInvModel;
+	Tangent = normalize( aModel[0].xyz );
+	Up = normalize( aModel[1].xyz );
+	Bitangent = normalize( aModel[2].xyz );
+	gl_Position = viewProjection * aModel * vec4( aPos, 1.0 );
 
 }
\ No newline at end of file
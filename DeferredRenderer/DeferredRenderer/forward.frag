@@ -1,13 +1,13 @@
 #version 330 core
 layout(location = 0) out vec4 FragColor;
 
-uniform vec3 lightColour;
+in vec3 Colour;
 
 // Nothing fancy, just add the colour of the lights to the emitters.
 
 void main()
 {
 
-	FragColor = vec4( lightColour, 1 );
+	FragColor = vec4( Colour, 1 );
 
 }
\ No newline at end of file
@@ -2,15 +2,20 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
+// Per instance, one gizmo per light.
+layout(location = 3) in mat4 aModel;
+layout(location = 7) in vec3 aColour;
 
 uniform mat4 projection;
 uniform mat4 view;
-uniform mat4 model;
+
+out vec3 Colour;
 
 // Pass through normal vertex buffer, transform vertices to the 
 // usual eye space.
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	Colour = aColour;
+	gl_Position = projection * view * aModel * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -9,34 +9,32 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords; 
+// Per instance, the whole scene is drawn in one call.
+layout (location = 3) in mat4 aModel;
 
 
 out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
 
-// We need to send the depth map in light space to our fragment shader.
-out vec4 FragPosLightSpace;
+uniform mat4 viewProjection;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+// The depth pre-pass draws the same positions with shadowMapping.vert, the G-buffer pass only keeps
+// fragments whose depth is equal to what it wrote, so both have to come out bit for bit the same.
+invariant gl_Position;
 
 void main()
 {
 
 	// We want our fragment's positions and our normals to be in
 	// world space to perform our lighting pass later on.
-    vec4 worldPos = model * vec4( aPos, 1 );
+    vec4 worldPos = aModel * vec4( aPos, 1 );
     FragPos = worldPos.xyz; 
     TexCoords = aTexCoords;
     
-    mat3 normalMatrix = transpose( inverse( mat3( model ) ) );
+    mat3 normalMatrix = transpose( inverse( mat3( aModel ) ) );
     Normal = normalMatrix * aNormal;
 
-	FragPosLightSpace = lightSpaceMatrix * worldPos;
-
-    gl_Position = projection * view * worldPos;
+    gl_Position = viewProjection * worldPos;
 
 }
\ No newline at end of file
@@ -1,13 +1,21 @@
-#version 330 core
+#version 430 core
+// Specialized by RenderEngine::lightingDefines(), a feature that is off isn't in the program at all:
+// TILED reads the tile lists, POINT_LIGHTS loops over point lights (at most MAX_POINT_LIGHTS, when
+// defined, so the loop can be unrolled), POINT_SHADOWS samples the atlas for the shadowed ones and
+// SPOTLIGHT adds the spotlight and the shadow mask.
 out vec4 FragColor;
 
 in vec2 TexCoords;
 
 // Get our geometry buffer's data.
-uniform sampler2D gPosition;
+uniform sampler2D gDepth;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedoSpec;
-uniform sampler2D gAlbedoSpecD;
+uniform mat4 invViewProjection;
+
+#ifdef SPOTLIGHT
+// How lit every pixel is by the spotlight, from shadowMask.frag.
+uniform sampler2D shadowMask;
 
 // Custom SpotLight structure to keep everything organized.
 struct SpotLight
@@ -17,28 +25,29 @@ struct SpotLight
 	vec3 RayDirection;
 	vec3 Colour;
 	float Cutoff;
-	float OuterCuttoff;
+	float OuterCutoff;
 
 };
 uniform SpotLight spotLight;
-
-// Same goes for our point lights.
-struct Light 
+#endif
+
+#ifdef POINT_LIGHTS
+// The point lights are the light list in prelude.glsl, the CPU tells us how many of them are valid
+// this frame.
+uniform int lightCount;
+#endif
+
+// Tiled mode, lightCulling.comp already found the lights that can reach each 16x16 tile so we
+// only loop over our tile's list (see LightCulling.h for the layout).
+#ifdef TILED
+layout( std430, binding = 1 ) readonly buffer TileBlock
 {
 
-    vec3 Position;
-    vec3 Colour;
-    
-    float Linear;
-    float Quadratic;
-    float Radius;
+	uint tileLights[];
 
 };
-
-// Unfortunately we can't send the number of lights as a uniform to get this value 
-// automatically, so just hard-code it here for our loop.
-const int NR_LIGHTS = 30;
-uniform Light lights[NR_LIGHTS];
+uniform int tilesX;
+#endif
 uniform vec3 viewPos;
 
 float decay( vec3 lightPos, vec3 fragPos, float Kl, float Kq )
@@ -58,23 +67,55 @@ float distSquared( vec3 A, vec3 B )
 
 }
 
+// Rebuilds the world position from the depth buffer, uv and depth both in [0, 1].
+vec3 worldFromDepth( vec2 uv, float depth )
+{
+
+	vec4 position = invViewProjection * vec4( vec3( uv, depth ) * 2.0 - 1.0, 1.0 );
+	return position.xyz / position.w;
+
+}
+
 void main()
 {             
     // Get the data from the gBuffer.
-    vec3 FragPos = texture( gPosition, TexCoords ).rgb;
-    vec4 Normal = texture( gNormal, TexCoords );
+	float depth = texture( gDepth, TexCoords ).r;
+    
+	// Make sure that we do not colour not geometric stuff, nothing was drawn where the depth is still cleared.
+	if( depth == 1.0 ) discard;
+
+    vec3 FragPos = worldFromDepth( TexCoords, depth );
+    vec3 Normal = decodeNormal( texture( gNormal, TexCoords ).rg );
     vec3 Diffuse = texture( gAlbedoSpec, TexCoords ).rgb;
     float Specular = texture( gAlbedoSpec, TexCoords ).a;
-    
-	// Make sure that we do not colour not geometric stuff.
-	if( Normal.xyz == vec3( 0 ) ) discard;
 
     // Normal lighting calculations.
     vec3 lighting  = Diffuse * 0.1; // TODO: Find a better way of doing this.
     vec3 viewDir  = normalize( viewPos - FragPos );
     
-	for( int i = 0; i < NR_LIGHTS; ++i )
+#ifdef POINT_LIGHTS
+#ifdef TILED
+	ivec2 tile = ivec2( gl_FragCoord.xy ) / TILE_SIZE;
+	uint tileBase = uint( tile.y * tilesX + tile.x ) * uint( MAX_LIGHTS_PER_TILE + 1 );
+	int count = int( tileLights[tileBase] );
+	++tileBase;
+#else
+	int count = lightCount;
+#endif
+
+#ifdef MAX_POINT_LIGHTS
+	for( int j = 0; j < MAX_POINT_LIGHTS; ++j )
     {
+		if( j >= count ) break;
+#else
+	for( int j = 0; j < count; ++j )
+    {
+#endif
+#ifdef TILED
+		int i = int( tileLights[tileBase + uint( j )] );
+#else
+		int i = j;
+#endif
         // Early escape when the distance between the fragment and the light 
 		// is smaller than the light volume/sphere threshold.
         //float dist = length(lights[i].Position - FragPos);
@@ -96,20 +137,29 @@ void main()
 			//              /  |     B
 			//             ---------------->
             vec3 lightDir = normalize( lights[i].Position - FragPos );
-            vec3 diffuse = max( dot( Normal.xyz, lightDir ), 0.0 ) * Diffuse * lights[i].Colour;
+            vec3 diffuse = max( dot( Normal, lightDir ), 0.0 ) * Diffuse * lights[i].Colour;
             // specular
             vec3 halfwayDir = normalize( lightDir + viewDir );  
-            float spec = pow( max( dot( Normal.xyz, halfwayDir ), 0.0 ), 16.0 );
+            float spec = pow( max( dot( Normal, halfwayDir ), 0.0 ), 16.0 );
             vec3 specular = lights[i].Colour * spec * Specular;
             // attenuation
 			// Don't forget to calculate the square root of the dist variable,
 			// we have to do so manually as we optimized by skipping it early.
             float attenuation = decay( lights[i].Position, FragPos, lights[i].Linear ,lights[i].Quadratic );
+#ifdef POINT_SHADOWS
+			if( lights[i].Shadow >= 0 )
+			{
+
+				attenuation *= pointShadow( lights[i].Shadow, lights[i].Position, FragPos, Normal );
+
+			}
+#endif
             diffuse *= attenuation;
             specular *= attenuation;
             lighting += diffuse + specular;
         }
     }    
+#endif
 
 	// SpotLight.
 	/*vec3 lig = normalize( spotLight.Position - FragPos );
@@ -118,8 +168,8 @@ void main()
 	vec3 ref = reflect( -lig, Normal );
 
 	float the = max( dot( lig, normalize( -spotLight.RayDirection ) ), 0.0 );
-	float eps = spotLight.Cutoff - spotLight.OuterCuttoff;
-	float inte = clamp( ( the - spotLight.OuterCuttoff ) / eps, 0.0, 1.0 );
+	float eps = spotLight.Cutoff - spotLight.OuterCutoff;
+	float inte = clamp( ( the - spotLight.OuterCutoff ) / eps, 0.0, 1.0 );
 
 	vec3 diff = inte * atte * dif * Diffuse * spotLight.Colour;
 	vec3 spe = inte * atte * spotLight.Colour * pow( max( dot( viewDir, ref ), 0.0 ), 32.0 );
@@ -128,22 +178,24 @@ void main()
 
 	lighting += diff + spe;*/
 
+#ifdef SPOTLIGHT
 	// SpotLight.
 	vec3 lig = normalize( spotLight.Position - FragPos );
 	float the = dot( lig, normalize( -spotLight.RayDirection ) );
 
-	float diff = max( dot( Normal.xyz, lig ), 0.0 );
-	vec3 ref = reflect( -lig, Normal.xyz );
+	float diff = max( dot( Normal, lig ), 0.0 );
+	vec3 ref = reflect( -lig, Normal );
 	float atte = decay( spotLight.Position, FragPos, 0.09, 0.032 );
-	float e = spotLight.Cutoff - spotLight.OuterCuttoff;
-	float inte = clamp( ( the - spotLight.OuterCuttoff ) / e, 0.0, 1.0 );
+	float e = spotLight.Cutoff - spotLight.OuterCutoff;
+	float inte = clamp( ( the - spotLight.OuterCutoff ) / e, 0.0, 1.0 );
 
 	//vec3 amb = inte * atte * objectColours[0];// *0.5 + 0.5 * n.y;
 	vec3 dif = inte * Diffuse * spotLight.Colour * diff;
 	vec3 spe = inte * Specular * spotLight.Colour * pow( max( dot( viewDir, ref ), 0.0 ), 32.0 );
 
 	lighting += dif + spe;
-	lighting *= Normal.w;
+	lighting *= texture( shadowMask, TexCoords ).r;
+#endif
 
 	FragColor = vec4( lighting, 1 );
 
@@ -0,0 +1,7 @@
+#version 430 core
+
+// Only the stencil buffer is written while marking a light's volume, there is nothing to shade.
+void main()
+{
+
+}
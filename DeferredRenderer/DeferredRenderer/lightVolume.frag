@@ -0,0 +1,85 @@
+#version 430 core
+// Specialized like lightBuffer.frag: POINT_SHADOWS when this light is shadowed, SPOTLIGHT when the
+// spotlight's shadow mask scales the lighting.
+out vec4 FragColor;
+
+// Get our geometry buffer's data.
+uniform sampler2D gDepth;
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+#ifdef SPOTLIGHT
+// How lit every pixel is by the spotlight, from shadowMask.frag.
+uniform sampler2D shadowMask;
+#endif
+
+uniform mat4 invViewProjection;
+
+// Our light in the light list, see prelude.glsl.
+uniform int lightIndex;
+uniform vec3 viewPos;
+
+float decay( vec3 lightPos, vec3 fragPos, float Kl, float Kq )
+{
+
+	float dist = distance( lightPos, fragPos );
+
+	return 1.0 / ( 1.0 + Kl * dist + Kq * ( dist * dist ) );
+
+}
+
+float distSquared( vec3 A, vec3 B )
+{
+
+	vec3 C = A - B;
+	return dot( C, C );
+
+}
+
+// Rebuilds the world position from the depth buffer, uv and depth both in [0, 1].
+vec3 worldFromDepth( vec2 uv, float depth )
+{
+
+	vec4 position = invViewProjection * vec4( vec3( uv, depth ) * 2.0 - 1.0, 1.0 );
+	return position.xyz / position.w;
+
+}
+
+// One light at a time, we only run for the pixels the stencil pass found inside this light's
+// sphere and the result is added on top of the full screen pass (ambient + spotlight).
+void main()
+{
+
+	// We are drawing a sphere, not a screen quad, so fetch the texel under this fragment.
+	ivec2 pixel = ivec2( gl_FragCoord.xy );
+	float depth = texelFetch( gDepth, pixel, 0 ).r;
+	if( depth == 1.0 ) discard;
+
+	vec3 FragPos = worldFromDepth( gl_FragCoord.xy / vec2( textureSize( gDepth, 0 ) ), depth );
+	vec3 Normal = decodeNormal( texelFetch( gNormal, pixel, 0 ).rg );
+	vec4 AlbedoSpec = texelFetch( gAlbedoSpec, pixel, 0 );
+	vec3 Diffuse = AlbedoSpec.rgb;
+	float Specular = AlbedoSpec.a;
+
+	// The sphere is a bit bigger than the light's radius, keep the exact test.
+	Light light = lights[lightIndex];
+	if( distSquared( light.Position, FragPos ) >= light.Radius * light.Radius ) discard;
+
+	vec3 viewDir = normalize( viewPos - FragPos );
+	vec3 lightDir = normalize( light.Position - FragPos );
+	vec3 diffuse = max( dot( Normal, lightDir ), 0.0 ) * Diffuse * light.Colour;
+	vec3 halfwayDir = normalize( lightDir + viewDir );
+	float spec = pow( max( dot( Normal, halfwayDir ), 0.0 ), 16.0 );
+	vec3 specular = light.Colour * spec * Specular;
+	float attenuation = decay( light.Position, FragPos, light.Linear, light.Quadratic );
+#ifdef POINT_SHADOWS
+	attenuation *= pointShadow( light.Shadow, light.Position, FragPos, Normal );
+#endif
+
+	vec3 lit = ( diffuse + specular ) * attenuation;
+#ifdef SPOTLIGHT
+	// Shadows scale the whole sum in lightBuffer.frag, so they scale every term we add too.
+	lit *= texelFetch( shadowMask, pixel, 0 ).r;
+#endif
+	FragColor = vec4( lit, 1.0 );
+
+}
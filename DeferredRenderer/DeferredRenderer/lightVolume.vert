@@ -0,0 +1,16 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 projection;
+uniform mat4 view;
+// Our light in the light list, see prelude.glsl.
+uniform int lightIndex;
+
+// The unit sphere gets moved and scaled to the light's volume, so the CPU only sends an index.
+void main()
+{
+
+	vec3 worldPos = lights[lightIndex].Position + aPos * lights[lightIndex].Radius;
+	gl_Position = projection * view * vec4( worldPos, 1.0 );
+
+}
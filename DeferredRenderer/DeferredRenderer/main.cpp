@@ -5,42 +5,160 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "Shader.h"
+#include "GLState.h"
+#include "ProgramCache.h"
+#include "ShaderPermutations.h"
+#include "HeadlessContext.h"
+#include "Profiler.h"
+#include "Benchmark.h"
+#include "LightBuffer.h"
+#include "LightCulling.h"
+#include "MeshRegistry.h"
+#include "Transforms.h"
+#include "Bvh.h"
+#include "JobSystem.h"
+#include "ShadowCascades.h"
+#include "ShadowAtlas.h"
+#include "Decals.h"
+#include "DynamicResolution.h"
+#include "RenderGraph.h"
+#include "RenderTargetPool.h"
+#include "TextureStreamer.h"
 
 #define STB_IMAGE_IMPLEMENTATION    
 #include "stb_image.h"
 
 #include <vector>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <random>
+#include <string>
+#include <thread>
 
 // This engine is heavily based on:
 // https://learnopengl.com/Advanced-Lighting/Deferred-Shading
 // https://research.ncl.ac.uk/game/mastersdegree/graphicsforgames/deferredrendering/Tutorial%2015%20-%20Deferred%20Rendering.pdf
 // and coding concepts from https://vulkan-tutorial.com/
 
+// What goes into the scene, shared by the interactive and the headless modes.
+struct SceneSettings
+{
+
+	uint32_t lights = 30;
+	// Cubes in the grid, the default is the original 8x8.
+	uint32_t objects = 64;
+	// The fraction of them that bob, spread evenly over the grid, the rest never move.
+	float moving = 1.0f;
+	// Threads that prepare frames, counting the GL thread, 0 uses every core.
+	uint32_t threads = 0;
+	// How the spotlight's shadow map gets split along the camera's view.
+	CascadeSettings cascades;
+	ShadowFilterSettings shadowFilter;
+	// Which point lights cast shadows and how much room they get.
+	ShadowAtlasSettings shadowAtlas;
+	// Lays the camera's depth down first so the G-buffer only shades the fragments that end up visible.
+	bool depthPrepass = false;
+	// Renders at a fraction of the output's size when the GPU can't keep up.
+	DynamicResolutionSettings resolution;
+	// Decals scattered over the ground, all of them one draw.
+	uint32_t decals = 32;
+	// Off drops the spotlight from the lighting along with its shadows.
+	bool spotlight = true;
+	// Where linked programs are kept between launches, empty compiles every program every time.
+	std::string shaderCache = "ShaderCache";
+	// Kilobytes of texture data streamed to GL per frame at most.
+	uint32_t streamBudget = 2048;
+
+};
+
+// How the point lights get applied in the lighting pass.
+enum class LightingMode
+{
+
+	// Every pixel loops over every light.
+	FullScreen,
+	// A compute pass bins the lights into screen tiles first, every pixel only loops over its tile's lights.
+	Tiled,
+	// Every light is drawn as a sphere, the stencil buffer keeps only the pixels inside its volume.
+	Volumes
+
+};
+
+// What the lighting programs get specialized for, see lightingDefines(). Without either light count
+// bucket there are no point lights in the program.
+static constexpr uint32_t LIGHTING_TILED = 1 << 0;
+static constexpr uint32_t LIGHTING_SPOTLIGHT = 1 << 1;
+static constexpr uint32_t LIGHTING_POINT_SHADOWS = 1 << 2;
+static constexpr uint32_t LIGHTING_FEW_LIGHTS = 1 << 3;
+static constexpr uint32_t LIGHTING_MANY_LIGHTS = 1 << 4;
+
 class RenderEngine
 {
 
 public:
 
+	explicit RenderEngine( const SceneSettings& scene, LightingMode lightingMode = LightingMode::Tiled ) 
+		: scene( scene ), lightingMode( lightingMode ) {}
+
 	void run()
 	{
 
+		launched = std::chrono::high_resolution_clock::now();
 		initWindow();
 		setupDepth();
 		initGeometry();
+		initPasses();
+		reportStartup();
 		renderLoop();
 
 	}
 
+	// Same engine but without a window, renders a fixed number of deterministic frames and writes the
+	// per pass timings to a JSON file.
+	void runHeadless( const BenchmarkSettings& settings )
+	{
+
+		launched = std::chrono::high_resolution_clock::now();
+		initHeadless();
+		setupDepth();
+		initGeometry();
+		initPasses();
+		reportStartup();
+		benchmarkLoop( settings );
+
+	}
+
 private:
 
+	SceneSettings scene;
+
 	GLFWwindow* window;
 
+	// Headless mode, there is no default framebuffer so we render the final image to our own.
+	HeadlessContext headless;
+	bool isHeadless = false;
+	// Where the final image goes, 0 is the window.
+	unsigned int outputFBO = 0;
+	unsigned int outputColour = 0, outputDepth = 0;
+
+	// GPU/CPU timings for every pass, press P to print them.
+	Profiler profiler;
+	// Filled while initializing, reported before the first frame and once it is done.
+	StartupTimings startup;
+	std::chrono::high_resolution_clock::time_point launched;
+
 	// Original size of the window.
 	const uint16_t WIDTH = 1200, HEIGHT = 800;
 	bool framebufferResized = false;
+	// The window's framebuffer as it is now, the final image and the forward pass are this big.
+	uint32_t outputWidth = WIDTH, outputHeight = HEIGHT;
+	// The G-buffer, the shadow mask and the lighting are rendered at the output's size times the
+	// dynamic resolution's scale, the upscale pass stretches the result over the output.
+	uint32_t renderWidth = WIDTH, renderHeight = HEIGHT;
+	DynamicResolution dynamicResolution;
 
 	// The current time since we started rendering.
 	float time = 0.0f;
@@ -48,29 +166,101 @@ private:
 	// Shader pointers.
 	// Geometry pass.
 	Shader* shaderG;
-	// Light pass.
-	Shader* shaderL;
 	// Forward render pass.
 	Shader* shaderF;
 	// Shadow mapping pass.
 	Shader* shaderShadow;
+	// Screen space shadows, filters the shadow map once per pixel.
+	Shader* shaderMask;
 	// Decals.
 	Shader* shaderD;
+	// Light volumes, one program marks the stencil the other one shades.
+	Shader* shaderStencil;
+
+	// Uniform locations, resolved once after linking so the frame loop never builds or hashes a string.
+	struct ShadowUniforms
+	{
+
+		GLint lightSpaceMatrix;
+
+	} uniformsShadow;
+
+	struct GeometryUniforms
+	{
+
+		GLint viewProjection, viewPos, time;
+
+	} uniformsG;
+
+	struct ShadowMaskUniforms
+	{
 
-	// GBuffer ids.
-	// FBO.
-	unsigned int gBuffer;
-	// Textures.
-	unsigned int gPosition, gNormal, gAlbedoSpec;
-
-	// Shadow map.
-	// Size.
-	const uint16_t SHA_WIDTH = 1024, SHA_HEIGHT = 1024;
-	// Ids.
-	// FBO.
-	unsigned int depthFBO;
-	// Textures.
-	unsigned int depthMap;
+		GLint view, invViewProjection, lightPos, lightSpaceMatrices;
+
+	} uniformsMask;
+
+	struct LightingUniforms
+	{
+
+		GLint spotPosition, spotDirection, spotColour, spotCutoff, spotOuterCutoff, viewPos, invViewProjection,
+			  lightCount;
+
+	};
+
+	struct ForwardUniforms
+	{
+
+		GLint view;
+
+	} uniformsF;
+
+	struct VolumeUniforms
+	{
+
+		GLint view, lightIndex, viewPos, invViewProjection;
+
+	} uniformsStencil;
+
+	// The lighting pass and the light volumes run the narrowest program for what the frame has, every
+	// variant is compiled the first time a frame needs it.
+	ShaderPermutations<LightingUniforms> lightingShaders;
+	ShaderPermutations<VolumeUniforms> volumeShaders;
+	// Up to this many point lights the lighting loop has a constant bound.
+	static constexpr uint32_t FEW_LIGHTS = 16;
+
+	// Only changes with the window's shape, see resizeOutput().
+	glm::mat4 projection;
+	PerspectiveParameters cameraPerspective = { glm::radians( 45.0f ), ( float )WIDTH / ( float )HEIGHT, 0.1f, 100.0f };
+	// The spotlight's whole cone, every shadow cascade is a piece of it.
+	// The perspective projection has to have a ratio of 1.0f, apparently.
+	// https://forums.raywenderlich.com/t/chapter-14-spotlight-shadow-map/60775/3
+	const PerspectiveParameters lightPerspective = { glm::radians( 75.0f ), 1.0f, 0.1f, 100.0f };
+
+	// Every render size target below comes from here, acquired by the first pass that writes it and
+	// released after the last one that reads it, every frame.
+	RenderTargetPool targets;
+	RenderResource output = RenderGraph::NONE;
+
+	// GBuffer, there is no position, it comes back from the depth.
+	RenderResource gNormal, gAlbedoSpec, gDepth;
+
+	// The light volumes add up hundreds of small contributions, an 8 bit target would round most of
+	// them away so they accumulate in half floats. They get a copy of the G-buffer's depth/stencil, the
+	// original is sampled while they draw.
+	RenderResource lightAccum, lightAccumDepth;
+	// The lit image at the render size, when that isn't the output's the full screen lighting goes here
+	// first. The light volumes have their own target already.
+	RenderResource sceneColour;
+
+	// Shadow map, one layer per cascade.
+	ShadowCascades shadowCascades;
+	// How lit every pixel is by the spotlight, written by the screen space shadow pass.
+	RenderResource shadowMask;
+	// Texture units the shadow pass reads the cascades from, the G-buffer takes the first ones.
+	static constexpr GLuint SHADOW_COMPARE_UNIT = 4, SHADOW_DEPTH_UNIT = 5;
+	// The point lights' shadows, the lighting passes read them from their own unit.
+	ShadowAtlas shadowAtlas;
+	static constexpr GLuint SHADOW_ATLAS_UNIT = 6;
 
 	// User interaction.
 	// OpenGL is right handed so the last component corresponds to move forward/backwards.
@@ -85,37 +275,138 @@ private:
 	// How much time between frames.
 	float deltaTime = 0.0f, lastFrame = 0.0f;
 
-	// Geometry's ids.
-	GLuint quadVertexArrayObject, quadVertexBufferObject, quadElementBufferObject,
-		   screenQuadVertexArrayObject = 0, screenQuadVertexBufferObject,
-		   cubeVertexArrayObject = 0, cubeVertexBufferObject;
+	// Geometry, uploaded once by initMeshes() and only drawn through these handles afterwards.
+	MeshRegistry meshes;
+	MeshHandle groundQuad, screenQuad, cube, sphere;
 
 	// Lights.
-	const uint16_t NUMBER_OF_LIGHTS = 30;
+	// The point lights orbit around the center in this many rings, when there are more lights than
+	// rings they share the rings at different phases.
+	const uint16_t LIGHT_RINGS = 30;
 	const float constant = 1.0;
 	const float linear = 0.7;
 	const float quadratic = 1.8;
 	// Spotlight position.
 	// Lights that go in a direction similar to dawn are more cinematic!
 	glm::vec3 lightPos = glm::vec3( 0.0f, 1.5f, 2.5f );
-	glm::vec3 lightDir = glm::vec3( -10.0f, -0.5f, 1.5f ) - lightPos;
 	glm::vec3 lightCol = glm::vec3( 1.0f );
 
 	std::vector<glm::vec3> lightPositions, lightColours;
+	// The radius only depends on the colour and the attenuation, so we compute it once.
+	std::vector<float> lightRadii;
+	LightBuffer lightBuffer;
+	// Per tile light lists, press L to cycle between tiled, full screen and light volume lighting.
+	LightCulling lightCulling;
+	LightingMode lightingMode;
+	uint32_t lightCount = 0;
+
+	// Decals, their boxes' matrices and the texture every one of them projects.
+	DecalBatch decals;
+	TextureStreamer::Handle decalTexture = 0;
+	struct DecalUniforms
+	{
 
-	// Decals.
-	// ID.
-	unsigned int texture1;
-	// FBO.
-	unsigned int gBufferD;
-	// Textures.
-	unsigned int gPositionD, gNormalD, gAlbedoSpecD;
+		GLint viewProjection, invViewProjection;
 
+	} uniformsD;
+
+	// Every entity's transform, laid out so each group below is a consecutive range of entities:
+	// the moving objects, the still ones, the ground, then the spotlight's gizmo followed by one gizmo per
+	// light and the decals' boxes. Everything from the first still object to the ground casts the cached
+	// shadows.
+	TransformSystem transforms;
+	Entity firstObject = 0, firstStill = 0, ground = 0, firstGizmo = 0, firstDecal = 0;
+	uint32_t gizmoCount = 0;
 	// Objects.
-	std::vector<glm::vec3> objectPositions;
+	// Where each moving object's bobbing starts from, one per moving object.
+	std::vector<float> objectRestHeights;
+	// The grid always covers the same area, with more objects they get smaller.
+	float objectScale = 0.8f;
+
+	// Instancing, the cube VAOs read their model matrix (locations 3 to 6) and colour (7) per instance.
+	GLuint gizmoInstanceBufferObject, gizmoColourBufferObject, gizmoCubeVertexArrayObject;
+
+	// Culling, every view only draws the objects that touch its frustum. The still objects' tree is built
+	// once and only refit if one of them moves.
+	Bvh movingBvh, stillBvh;
+	// Where one view's visible objects go on the GPU, the matrices get packed in its own instance buffer.
+	struct VisibleObjects
+	{
 
-	// Our global model matrix, we need this since we are going to be calling this in different functions.
-	glm::mat4 model = glm::mat4( 1.0f );
+		GLuint instanceBufferObject = 0, vertexArrayObject = 0;
+		GLsizei count = 0;
+
+	};
+	// Every shadow cascade culls on its own, its still casters only when its cached layer gets redrawn.
+	VisibleObjects cameraObjects, shadowObjects[ ShadowCascades::MAX_CASCADES ],
+				   stillShadowObjects[ ShadowCascades::MAX_CASCADES ];
+	// Every atlas face's casters share one instance buffer, each face draws its range of it.
+	VisibleObjects atlasObjects;
+	struct InstanceRange
+	{
+
+		GLuint first;
+		GLsizei count;
+
+	};
+	std::vector<InstanceRange> atlasRanges;
+	std::vector<glm::mat4> atlasMatrices;
+
+	// Frame pipelining. The job system prepares everything the next frame needs (animation, matrices,
+	// culling and sorting) while the GL thread submits the current one, which only reads its FrameData.
+	JobSystem jobs;
+	// Decodes on the job system's workers, uploads a bit every frame.
+	TextureStreamer streamer;
+	JobSystem::Group preparing;
+	// One view's objects, nearest first.
+	struct DrawList
+	{
+
+		std::vector<uint32_t> indices;
+		std::vector<glm::mat4> matrices;
+		// Scratch for sorting them, it lives with the list so its memory is reused every frame.
+		std::vector<std::pair<float, uint32_t>> order;
+
+	};
+	struct FrameData
+	{
+
+		// Inputs, copied from the engine when the frame starts being prepared.
+		float time = 0.0f;
+		glm::vec3 camPos, camFront, lightPos;
+
+		// Everything computed from them.
+		glm::mat4 view, ground;
+		glm::mat4 lightSpaces[ ShadowCascades::MAX_CASCADES ];
+		glm::vec3 lightDir;
+		std::vector<GpuLight> lights;
+		std::vector<glm::mat4> gizmos;
+		// Only filled in when a decal moved, the GPU keeps the last ones otherwise.
+		std::vector<GpuDecal> decals;
+		bool decalsMoved = false;
+		DrawList cameraObjects, shadowObjects[ ShadowCascades::MAX_CASCADES ],
+				 stillShadowObjects[ ShadowCascades::MAX_CASCADES ];
+		// Which cascades draw their still casters again, see ShadowCascades::stale.
+		bool refreshShadows[ ShadowCascades::MAX_CASCADES ] = {};
+		// The point lights that can cast shadows, with how many pixels they cover, most first. The first
+		// atlasViews.size() / FACES of them got tiles, one view, tile and draw list per face.
+		std::vector<std::pair<float, uint32_t>> shadowCandidates;
+		std::vector<GpuShadowView> atlasViews;
+		std::vector<AtlasTile> atlasTiles;
+		std::vector<DrawList> atlasObjects;
+		double prepareMs = 0.0;
+
+	};
+	FrameData frames[ 2 ];
+
+	// The frame's passes, see buildRenderGraph(). It gets built again when the lighting mode or the
+	// upscaling change, the passes read the frame being submitted and its inverse view projection from
+	// here.
+	RenderGraph graph;
+	bool graphBuilt = false, graphUpscaled = false;
+	LightingMode graphLighting = LightingMode::Tiled;
+	const FrameData* submitting = nullptr;
+	glm::mat4 invViewProjection;
 
 	void initWindow()
 	{
@@ -139,6 +430,7 @@ private:
 		glfwMakeContextCurrent( window );
 		glfwSetFramebufferSizeCallback( window, framebufferResizeCallback );
 		glfwSetMouseButtonCallback( window, mouseClickCallBack );
+		glfwSetKeyCallback( window, keyCallback );
 		glfwSetCursorPosCallback( window, mouseCallback );
 		// https://stackoverflow.com/questions/4431637/hiding-mouse-cursor-with-glfw
 		glfwSetInputMode( window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN );
@@ -150,684 +442,1870 @@ private:
 			throw std::runtime_error( "Unable to initialize glad!" );
 		
 		}
+		ProgramCache::init( scene.shaderCache, ( GLADloadproc )glfwGetProcAddress );
 
-		glViewport( 0, 0, WIDTH, HEIGHT );
+		// With display scaling the framebuffer isn't as big as the window.
+		int width = 0, height = 0;
+		glfwGetFramebufferSize( window, &width, &height );
+		outputWidth = std::max( width, 1 );
+		outputHeight = std::max( height, 1 );
+		cameraPerspective.aspect = ( float )outputWidth / ( float )outputHeight;
+		glViewport( 0, 0, outputWidth, outputHeight );
 
 		glEnable( GL_DEPTH_TEST );
 
 	}
 
-	void setupGBuffer( unsigned int* gBuffer, unsigned int* gPosition, unsigned int* gNormal, 
-					   unsigned int* gAlbedoSpec )
-	{
-
-		// This is a very memory consuming way of implementing a GBuffer it is possible to calculate it
-		// through the depth buffer. Maybe later.
-		glGenFramebuffers( 1, gBuffer );
-		glBindFramebuffer( GL_FRAMEBUFFER, *gBuffer );
-		// position color buffer
-		glGenTextures( 1, gPosition );
-		glBindTexture( GL_TEXTURE_2D, *gPosition );
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA16F, WIDTH, HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *gPosition, 0 );
-		// normal color buffer
-		glGenTextures( 1, gNormal );
-		glBindTexture( GL_TEXTURE_2D, *gNormal );
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA16F, WIDTH, HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, *gNormal, 0 );
-		// color + specular color buffer
-		glGenTextures( 1, gAlbedoSpec );
-		glBindTexture( GL_TEXTURE_2D, *gAlbedoSpec );
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, WIDTH, HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, *gAlbedoSpec, 0 );
-		// tell OpenGL which color attachments we'll use (of this framebuffer) for rendering 
-		unsigned int attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-		glDrawBuffers( 3, attachments );
-		// create and attach depth buffer (renderbuffer)
-		unsigned int rboDepth;
-		glGenRenderbuffers( 1, &rboDepth );
-		glBindRenderbuffer( GL_RENDERBUFFER, rboDepth );
-		glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT, WIDTH, HEIGHT );
-		glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth );
-		// finally check if framebuffer is complete
-		if( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+	void initHeadless()
+	{
+
+		isHeadless = true;
+		headless.create( 4, 3 );
+
+		if( !gladLoadGLLoader( ( GLADloadproc )HeadlessContext::getProcAddress ) )
 		{
 
-			throw std::runtime_error( "Framebuffer not complete!" );
-		
+			throw std::runtime_error( "Unable to initialize glad!" );
+
 		}
-		
-		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		ProgramCache::init( scene.shaderCache, ( GLADloadproc )HeadlessContext::getProcAddress );
+
+		// Stand-in for the window's framebuffer, same size and a depth buffer to blit into, with the
+		// G-buffer's depth/stencil format or the blit fails.
+		GLObjects::genFramebuffers( 1, &outputFBO );
+		glBindFramebuffer( GL_FRAMEBUFFER, outputFBO );
+		GLObjects::genRenderbuffers( 1, &outputColour );
+		glBindRenderbuffer( GL_RENDERBUFFER, outputColour );
+		glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT );
+		glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, outputColour );
+		GLObjects::genRenderbuffers( 1, &outputDepth );
+		glBindRenderbuffer( GL_RENDERBUFFER, outputDepth );
+		glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT );
+		glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, outputDepth );
+		if( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+		{
 
-	}
+			throw std::runtime_error( "Output framebuffer not complete!" );
 
-	void setupDepth()
-	{
+		}
+
+		glViewport( 0, 0, WIDTH, HEIGHT );
 
-		glGenFramebuffers( 1, &depthFBO );
-		glGenTextures( 1, &depthMap );
-		glBindTexture( GL_TEXTURE_2D, depthMap );
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHA_WIDTH, SHA_HEIGHT, 0, GL_DEPTH_COMPONENT, 
-					  GL_FLOAT, NULL );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER );
-		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER );
-		float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexParameterfv( GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border );
-		glBindFramebuffer( GL_FRAMEBUFFER, depthFBO );
-		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0 );
-		glDrawBuffer( GL_NONE ); 
-		glReadBuffer( GL_NONE );
-		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		glEnable( GL_DEPTH_TEST );
 
 	}
 
-	void renderLoop()
+	// The output or the scale changed, only ever between frames. The pool hands out targets at the new
+	// size from the next frame on and lets the old ones go, only the light tiles have to follow here.
+	void setRenderSize()
 	{
 
-		// Although there is no consensus on the extension for shader files, I am using a plugin for VS2019
-		// that enables some syntax highlighting and auto-completion called GLSL Language Integration and it
-		// accepts this two: "*.vert" and "*.frag".
-		// Watchout for the scope of these shaders.
-		shaderG = &Shader( "gBuffer.vert", "gBuffer.frag" );			// Watchout for the order..... 
-		shaderL = &Shader( "lightBuffer.vert", "lightBuffer.frag" );	// no, it's not a compiler bug!
-		shaderF = &Shader( "forward.vert", "forward.frag" );
-
-		// No need to compute this every frame as the FOV stays always the same.
-		glm::mat4 projection = glm::perspective( glm::radians( 45.0f ), ( float ) WIDTH / ( float ) HEIGHT,
-												 0.1f, 100.0f
-												);
-
-		//shaderD->createTexture( &texture1, "Assets/NotOurHome.png", "texture1", 3 );
-		
-		// ShadowMapping.
-		shaderShadow = &Shader( "shadowMapping.vert", "shadowMapping.frag" );
+		renderWidth = dynamicResolution.scaled( outputWidth );
+		renderHeight = dynamicResolution.scaled( outputHeight );
+		if( lightBuffer.usesStorage() )
+		{
 
-		setupGBuffer( &gBuffer, &gPosition, &gNormal, &gAlbedoSpec );
-		// Now send it to the shaders.
-		shaderG->use();
-		shaderG->setInt( "gPosition", 0 );
-		shaderG->setInt( "gNormal", 1 );
-		shaderG->setInt( "gAlbedoSpec", 2 );
-		shaderG->setMat4( "projection", projection );
-		//shaderG->createTexture( &texture1, "Assets/NotOurHome.png", "texture1", 3 );
-		//shaderG->createTexture( &texture1, "Assets/NotOurHome.png", "texture1", 1 );
+			lightCulling.resize( renderWidth, renderHeight );
+			lightingShaders.forEach( [ this ]( Shader& shader, LightingUniforms& )
+			{
 
-		setupGBuffer( &gBufferD, &gPositionD, &gNormalD, &gAlbedoSpecD );
-		// Decals.
-		shaderD = &Shader( "decal.vert", "decal.frag" );
+				shader.setInt( "tilesX", ( int )lightCulling.getTilesX() );
 
-		shaderD->use();
-		shaderD->setInt( "gPosition", 0 );
-		shaderD->setInt( "gNormal", 1 );
-		shaderD->setInt( "gAlbedoSpec", 2 );
-		shaderD->setMat4( "projection", projection );
-
-		/*shaderD->setInt( "outGPosition", 3 );
-		shaderD->setInt( "outGNormal", 4 );
-		shaderD->setInt( "outAlbedoSpec", 5 );
-		shaderD->createTexture( &texture1, "Assets/NotOurHome.png", "texture1", 6 );*/
-		
+			} );
 
-		// Light pass.
-		shaderL->use();
-		shaderL->setInt( "gPosition", 0 );
-		shaderL->setInt( "gNormal", 1 );
-		shaderL->setInt( "gAlbedoSpec", 2 );
-		//shaderL->createTexture( &texture1, "Assets/NotOurHome.png", "texture1", 3 );
+		}
 
-		shaderF->use();
-		shaderF->setMat4( "projection", projection );
-		shaderF->createTexture( &texture1, "Assets/NotOurHome.png", "texture1", 0 ); 
-		
-		//float nearPlane = 0.1f, farPlane = 20.5f;
+	}
 
-		// The perspective projection has to have a ratio of 1.0f, apparently.
-		// https://forums.raywenderlich.com/t/chapter-14-spotlight-shadow-map/60775/3
-		glm::mat4 lightProj = glm::perspective( glm::radians( 75.0f ), 1.0f,
-												0.1f, 100.0f
-												);/// glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, nearPlane, farPlane);
+	// The projection follows the window's shape, the shaders that don't get it per frame get it here.
+	void setProjection()
+	{
 
-		while( !glfwWindowShouldClose( window ) )
+		projection = glm::perspective( cameraPerspective.fovY, cameraPerspective.aspect,
+									   cameraPerspective.nearPlane, cameraPerspective.farPlane
+									 );
+		shaderStencil->use();
+		shaderStencil->setMat4( "projection", projection );
+		volumeShaders.forEach( [ this ]( Shader& shader, VolumeUniforms& )
 		{
 
-			// Calculate the time between frames.
-			static auto startTime = std::chrono::high_resolution_clock::now();
-
-			auto currentTime = std::chrono::high_resolution_clock::now();
-			time = std::chrono::duration<float, std::chrono::seconds::period>( currentTime - startTime ).count();
+			shader.setMat4( "projection", projection );
 
-			deltaTime = time - lastFrame;
-			lastFrame = time;
+		} );
+		shaderF->use();
+		shaderF->setMat4( "projection", projection );
 
-			// User interaction.
-			processInput( window );
+	}
 
-			glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
-			glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-			
-			// Create the camera (eye).
-			glm::mat4 view = glm::lookAt( camPos, camPos + camFront, camUp );
-
-			// Shadow Map
-			// To be able to render the shadow map, we are going to pre-render the scene from the light (in 
-			// this case a spot light) and save the result to the alpha component of the gNormal texture,
-			// we will later retrieve (during the light pass) this value to multiply our final colour to get 
-			// our shadows.
-			// Render the shadow map.
-			// This is realtime so why not?
-			// Calculate a vector from the parametric equation of a circle so that our spotlight can be directed
-			// radially.
-			// Uncomment the following lines for a moving spotlight.
-			//lightDir -= glm::vec3( 1.f * sin( time * 0.8 ), 0.0f, 1.0f * cos( time * 0.8 ) );
-			//lightDir = glm::normalize( lightDir );
-			lightDir = camFront;
-			glm::mat4 lightView = glm::lookAt( lightPos, lightPos + lightDir, glm::vec3( 0.0f, 1.0f, 0.0f ) );;
-			glm::mat4 lightSpace = lightProj * lightView;
-			shaderShadow->use();
-			shaderShadow->setMat4( "lightSpaceMatrix", lightSpace );
-
-			// We have a different resolution for our shadow map, for optimization reasons. Don't forget to 
-			// call the glViewport function to change the size we are rendering at.
-			glViewport( 0, 0, SHA_WIDTH, SHA_HEIGHT );
-			glBindFramebuffer( GL_FRAMEBUFFER, depthFBO );
-			glClear( GL_DEPTH_BUFFER_BIT );
-			//glActiveTexture( GL_TEXTURE0 );
-			//glBindTexture( GL_TEXTURE_2D,  );
-			renderScene( shaderShadow );
-			glBindFramebuffer( GL_FRAMEBUFFER, 0 );
-
-			// Back to our window's size.
-			glViewport( 0, 0, WIDTH, HEIGHT );
-			glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-
-			// Initialize the model matrix.
-			model = glm::mat4( 1.0f );
-
-			// 1st pass, this is when the geometry is added into the gBuffer.
-			glBindFramebuffer( GL_FRAMEBUFFER, gBuffer );
-			glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-			// Don't forget to activate, set the shader's index when adding uniforms!
-			shaderG->use();
-			shaderG->setMat4( "view", view );
-
-			//shaderG->setMat4( "model", model );
-			shaderG->setVec3( "lightPos", lightPos );
-			shaderG->setVec3( "viewPos", camPos );
-			shaderG->setFloat( "time", time );
-			shaderG->setMat4( "lightSpaceMatrix", lightSpace );
-			glActiveTexture( GL_TEXTURE0 );
-			glBindTexture( GL_TEXTURE_2D, depthMap );
-			renderScene( shaderG );			
-			//model = glm::mat4( 1.0f );
-			//model = glm::scale( model, glm::vec3( 0.5f ) );
-			//model = glm::translate( model, glm::vec3( 0.0f, -0.5f, 0.0f ) );
-			//renderCube();
-			//shaderG->setMat4( "decal", model );
-
-			glBindFramebuffer( GL_FRAMEBUFFER, 0 ); // Unbind.
-
-			// Decal pass.
-			// Making me crazy... Not working yet!
-			/*glBindFramebuffer( GL_FRAMEBUFFER, gBufferD );
-			glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-			// Don't forget to activate, set the shader's index when adding uniforms!
-			shaderD->use();
-			shaderD->setMat4( "view", view );
-
-			model = glm::mat4( 1.0f );
-			model = glm::scale( model, glm::vec3( 1.0f ) );
-			model = glm::translate( model, glm::vec3( 2.5f, -2.0f, 0.0f ) );
-			//model = glm::translate( model, glm::vec3( 2.5f, -2.0f, 0.0f ) );
-			//model = glm::rotate( model,  )
-			shaderD->setMat4( "model", model );
-			shaderD->setVec3( "lightColour", glm::vec3( 0.0f, 0.0f, 1.0f ) );
-			glActiveTexture( GL_TEXTURE0 );
-			glBindTexture( GL_TEXTURE_2D, gPosition );
-			glActiveTexture( GL_TEXTURE1 );
-			glBindTexture( GL_TEXTURE_2D, gNormal );
-			glActiveTexture( GL_TEXTURE2 );
-			glBindTexture( GL_TEXTURE_2D, gAlbedoSpec );
-			//renderScene( shaderD );	
-			renderCube();
-			//renderScene( shaderD );	
-
-			glBindFramebuffer( GL_FRAMEBUFFER, 0 ); // Unbind.*/
-
-			// 2nd pass, this is when the lighting is calculated by the lightBuffer.frag shader.
-			glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-
-			shaderL->use();
-			glActiveTexture( GL_TEXTURE0 );
-			glBindTexture( GL_TEXTURE_2D, gPosition );
-			glActiveTexture( GL_TEXTURE1 );
-			glBindTexture( GL_TEXTURE_2D, gNormal );
-			glActiveTexture( GL_TEXTURE2 );
-			glBindTexture( GL_TEXTURE_2D, gAlbedoSpec );
-			/*glActiveTexture( GL_TEXTURE2 ); 
-			glBindTexture( GL_TEXTURE_2D, gAlbedoSpecD );*/
-
-			// Send the spotlight.
-			shaderL->setVec3( "spotLight.Position", lightPos );
-			shaderL->setVec3( "spotLight.RayDirection", lightDir );
-			shaderL->setVec3( "spotLight.Colour", lightCol );
-			shaderL->setFloat( "spotLight.Cutoff", glm::cos( glm::radians( 12.5f ) ) );
-			shaderL->setFloat( "spotLight.OuterCutoff", glm::cos( glm::radians( 17.5f ) ) );
-
-			for( uint16_t i = 0; i < lightPositions.size(); ++i )
-			{
-			
-				// We are reusing so only compute once.
-				float c = 1.0f + 1.2f * i;
-				float t = time * 0.5f + i;
+	// The window's framebuffer changed size, nothing is being prepared while we are in here.
+	void resizeOutput()
+	{
 
-				lightPositions[i] = glm::vec3( c * sin( t ), 1.0f, c * cos( t ) );
-				shaderL->setVec3("lights[" + std::to_string(i) + "].Position", lightPositions[i]);
-				shaderL->setVec3("lights[" + std::to_string(i) + "].Colour", lightColours[i]);
-				// update attenuation parameters and calculate radius
-				shaderL->setFloat("lights[" + std::to_string(i) + "].Linear", linear);
-				shaderL->setFloat("lights[" + std::to_string(i) + "].Quadratic", quadratic);
-				// then calculate radius of light volume/sphere
-				const float maxBrightness = std::fmaxf(std::fmaxf(lightColours[i].r, lightColours[i].g), lightColours[i].b);
-				float radius = (-linear + std::sqrt(linear * linear - 4 * quadratic * (constant - (200.0f) * maxBrightness))) / (2.0f * quadratic);
-				shaderL->setFloat("lights[" + std::to_string(i) + "].Radius", radius);
-			
-			}
+		int width = 0, height = 0;
+		glfwGetFramebufferSize( window, &width, &height );
+		// Minimized, there is nothing to draw into until it comes back.
+		while( ( width == 0 || height == 0 ) && !glfwWindowShouldClose( window ) )
+		{
 
-			// Send the camera.
-			shaderL->setVec3( "viewPos", camPos );
+			glfwWaitEvents();
+			glfwGetFramebufferSize( window, &width, &height );
 
-			renderQuad();
+		}
+		framebufferResized = false;
 
-			// Add the depth buffer data to the default framebuffers' depth buffer. So that we can properly
-			// merge the deferred renderer with a normal forward renderer, this forward renderer will only
-			// render lights as very bright colours, nothing fancy yet.
-			glBindFramebuffer( GL_READ_FRAMEBUFFER, gBuffer );
-			glBindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
-			glBlitFramebuffer( 0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST );
-			glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		outputWidth = std::max( width, 1 );
+		outputHeight = std::max( height, 1 );
+		cameraPerspective.aspect = ( float )outputWidth / ( float )outputHeight;
+		shadowCascades.setAspect( cameraPerspective.aspect );
+		setProjection();
+		setRenderSize();
 
-			//shaderD->use();
-			//shaderD->setMat4( "view", view );
+	}
 
-			//model = glm::mat4( 1.0f );
-			//model = glm::scale( model, glm::vec3( 1.0f ) );
-			//model = glm::translate( model, glm::vec3( 2.5f, -2.0f, 0.0f ) );
-			////model = glm::rotate( model,  )
-			//shaderD->setMat4( "model", model );
-			//shaderD->setVec3( "lightColour", glm::vec3( 0.0f, 0.0f, 1.0f ) );
-			//renderCube();
+	// Between two frames: follows the window and lets the dynamic resolution pick the next scale.
+	void updateResolution()
+	{
 
+		if( framebufferResized )
+		{
 
-			// 3rd pass, through a forward render add lights representation to the scene.
-			shaderF->use();
-			shaderF->setMat4( "view", view );
+			resizeOutput();
 
-			model = glm::mat4( 1.0f );
-			model = glm::translate( model, lightPos );
-			model = glm::scale( model, glm::vec3( 0.2f ) );
-			//model = glm::rotate( model,  )
-			shaderF->setMat4( "model", model );
-			shaderF->setVec3( "lightColour", lightCol );
-			renderCube();
+		}
 
-			for( uint16_t i = 0; i < lightPositions.size(); ++i )
-			{
+		if( dynamicResolution.update( profiler.latest() ) )
+		{
 
-				model = glm::mat4( 1.0f );
-				model = glm::translate( model, lightPositions[i] );
-				model = glm::scale( model, glm::vec3( 0.085f ) );
-				shaderF->setMat4( "model", model );
-				shaderF->setVec3( "lightColour", lightColours[i] );
-				renderCube();
-				//cube( &cubeVertexArrayObject, &cubeVertexBufferObject );
+			setRenderSize();
 
-			}
+		}
 
-			glfwSwapBuffers( window );
-			glfwPollEvents();
+	}
 
-		}
+	void setupDepth()
+	{
 
-		// Don't leak!
-		free();
-		glfwTerminate();
+		shadowCascades.init( scene.cascades, cameraPerspective, lightPerspective );
+		shadowAtlas.init( scene.shadowAtlas );
 
 	}
 
-	void renderScene( Shader* shader )
+	void initPasses()
 	{
 
-		for( unsigned int i = 0; i < objectPositions.size(); i++ )
+		// Although there is no consensus on the extension for shader files, I am using a plugin for VS2019
+		// that enables some syntax highlighting and auto-completion called GLSL Language Integration and it
+		// accepts this two: "*.vert" and "*.frag".
+		// These used to be temporaries that only lived as long as renderLoop's stack frame, now that the
+		// setup lives in its own function they have to be heap allocated, they are released in free().
+		// The render size comes first, the targets and the light tiles depend on it.
+		dynamicResolution.init( scene.resolution );
+		renderWidth = dynamicResolution.scaled( outputWidth );
+		renderHeight = dynamicResolution.scaled( outputHeight );
+		// The light list has to exist first, its type decides how the lighting shader declares it.
+		lightBuffer.init( scene.lights );
+		// Every program starts with the declarations they share, see Shader::loadPrelude().
+		Shader::loadPrelude( "prelude.glsl" );
+		auto programsStart = std::chrono::high_resolution_clock::now();
+		// Tiled lighting reads the tile lists from a storage buffer, without one we can only go full screen.
+		std::string lightDefines = lightBuffer.defines();
+		if( lightBuffer.usesStorage() )
 		{
 
-			// Restart the matrix for each element.
-			model = glm::mat4( 1.0f );
-			model = glm::translate( model, objectPositions[i] + glm::vec3( 0.0f, 
-																			sin( time * 0.1f + i ) + 1.0f, 
-																			0.0f ) ) ;
-			model = glm::scale( model, glm::vec3( 0.8f ) );
-			//model = glm::rotate( model, glm::radians( -90.0f ), glm::vec3( 1.0f, 0.0f, 0.0f ) );
-			shader->setMat4( "model", model );
-			//GLuint VAO, VBO, EBO;
-			//quad( &VAO, &VBO, &EBO );
-			renderCube(); 
+			lightCulling.init( renderWidth, renderHeight, scene.lights, lightBuffer.defines() );
+			lightDefines += lightCulling.defines();
 
 		}
 
-		
-		model = glm::mat4( 1.0f );
-		model = glm::scale( model, glm::vec3( 40.0f ) );
-		model = glm::rotate( model, glm::radians( -90.0f ), glm::vec3( 1.0f, 0.0f, 0.0f ) );
-		model = glm::translate( model, glm::vec3( 0.0f, 0.0f, -0.05f ) );
-		shader->setMat4( "model", model );
-		//renderQuad();
-		quad( &quadVertexArrayObject, &quadVertexBufferObject, &quadElementBufferObject );
+		else if( lightingMode == LightingMode::Tiled )
+		{
 
-	}
+			lightingMode = LightingMode::FullScreen;
 
-	void initGeometry()
-	{
+		}
 
-		// Grid of geo.
-		for( float x = -20.0; x < 20.0; x += 5.0 )
+		shaderG = new Shader( "gBuffer.vert", "gBuffer.frag" );
+		shaderMask = new Shader( "lightBuffer.vert", "shadowMask.frag", shadowCascades.defines( scene.shadowFilter ) );
+		shaderF = new Shader( "forward.vert", "forward.frag" );
+		shaderStencil = new Shader( "lightVolume.vert", "lightStencil.frag", lightBuffer.defines() );
+		initLightingShaders( lightDefines + shadowAtlas.defines(), lightBuffer.defines() + shadowAtlas.defines() );
+
+		// ShadowMapping.
+		shaderShadow = new Shader( "shadowMapping.vert", "shadowMapping.frag" );
+		// Decals, they read the depth and write the other two.
+		shaderD = new Shader( "decal.vert", "decal.frag" );
+
+		// Every program is compiling by now (or came from the cache), take them as the driver gets them done.
+		std::vector<Shader*> programs = { shaderG, shaderMask, shaderF, shaderStencil, shaderShadow, shaderD };
+		// The variants the first frames need, the others wait until a frame asks for them.
+		bool pointShadows = shadowAtlas.maxLights() > 0;
+		programs.push_back( lightingShaders.prepare( lightingFeatures( scene.lights, pointShadows ) ) );
+		if( lightingMode == LightingMode::Volumes )
 		{
 
-			for( float y = -20.0; y < 20.0; y += 5.0 )
+			programs.push_back( volumeShaders.prepare( volumeFeatures( false ) ) );
+			if( pointShadows )
 			{
-			
-				objectPositions.push_back( glm::vec3( x, sin( x + y ) * 0.1f, y ) );
+
+				programs.push_back( volumeShaders.prepare( volumeFeatures( true ) ) );
 
 			}
 
 		}
-
-		for( uint16_t i = 0; i < NUMBER_OF_LIGHTS; ++i )
+		if( lightBuffer.usesStorage() )
 		{
 
-			lightPositions.push_back( glm::vec3( 0.0f ) );
-			lightColours.push_back( glm::vec3( get_random(), get_random(), get_random() ) );
+			programs.push_back( lightCulling.program() );
 
 		}
+		Shader::finishAll( programs );
+		if( lightBuffer.usesStorage() )
+		{
 
-	}
-
-	// https://stackoverflow.com/questions/686353/random-float-number-generation
-	float get_random()
-	{
-		static std::default_random_engine e;
-		static std::uniform_real_distribution<> dis(0, 1); // rage 0 - 1
-		return dis(e);
-	}
-
-	void quad( GLuint* vertexArrayObject, GLuint* vertexBufferObject, GLuint* elementBufferObject )
-	{
+			lightCulling.finishProgram();
 
-		std::vector<GLfloat> vertices =
-		{
+		}
+		startup.programsMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now() - programsStart ).count();
+		startup.cachedPrograms = ProgramCache::cachedPrograms();
+		startup.compiledPrograms = ProgramCache::compiledPrograms();
+		startup.parallelCompile = ProgramCache::parallelCompile();
 
-			// positions         // normals       // texCoords  
-			 0.5f,  0.5f, 0.0f,  0.0, 0.0, 1.0f,  1.0f, 1.0f,    // top right
-			 0.5f, -0.5f, 0.0f,  0.0, 0.0, 1.0f,  1.0f, 0.0f,    // bottom right
-			-0.5f, -0.5f, 0.0f,  0.0, 0.0, 1.0f,  0.0f, 0.0f,    // bottom left
-			-0.5f,  0.5f, 0.0f,  0.0, 0.0, 1.0f,  0.0f, 1.0f    // top left 
+		// Now send it to the shaders.
+		shaderG->use();
+		shaderG->setInt( "gDepth", 0 );
+		shaderG->setInt( "gNormal", 1 );
+		shaderG->setInt( "gAlbedoSpec", 2 );
 
-			// To compute the normals for a quad we only need to calculate the vector from each point 
-			// to each of it's neighbors:
-			//                             * A ------------------- * B
-			//                   ^         ^                       |
-			//                    \        |                       |
-			//                     \       |                       |
-			//                      \      |                       |
-			//                    e  \     |                       |  QUAD
-			//                        \    |                       |
-			//                         \   |-----                  |
-			//                          \  |     |                 |
-			//                           \ | D   |                 | C
-			//                             *---------------------->* 
-			// So if we want to calculate the normal for vertex D, we compute the cross product of vector A - D and
-			// vector C - D, which will give us the perpendicular/normal of D = e.
-		};
+		shaderMask->use();
+		shaderMask->setInt( "gDepth", 0 );
+		shaderMask->setInt( "gNormal", 1 );
+		shaderMask->setInt( "shadowMap", SHADOW_COMPARE_UNIT );
+		shaderMask->setInt( "shadowDepths", SHADOW_DEPTH_UNIT );
+		shaderMask->setFloat( "lightSize", scene.shadowFilter.lightSize );
+		// The splits never change, only the cascades' matrices do.
+		shaderMask->setInt( "cascadeCount", ( int )shadowCascades.count() );
+		shaderMask->setFloatArray( shaderMask->resolveUniform( "cascadeSplits[0]" ), shadowCascades.splitDepths(),
+								   ( GLsizei )shadowCascades.count() );
 
-		std::vector<GLuint> indices =
-		{
+		shaderD->use();
+		shaderD->setInt( "gDepth", 0 );
+		shaderD->setInt( "decalTexture", 1 );
+		// Transparent until it streams in, the decals just aren't there yet. Their edges shouldn't pick up
+		// the opposite side.
+		streamer.init( jobs, scene.streamBudget * 1024 );
+		decalTexture = streamer.load( "Assets/NotOurHome.png", glm::vec4( 0.0f ), GL_CLAMP_TO_EDGE );
 
-			0, 1, 3, // first triangle
-			1, 2, 3  // second triangle
 
-		};
 
-		// Create unique ID's for each of the OpenGL's objects.
-		glGenVertexArrays( 1, vertexArrayObject );
-		glGenBuffers( 1, vertexBufferObject );
-		glGenBuffers( 1, elementBufferObject );
+		setProjection();
+		resolveUniforms();
+		profiler.init();
+		graph.init( &targets, &profiler );
+		// The frames never clear the output unless a pass needs it, this one clear is so the first frame's
+		// timer queries don't come before any GPU work: llvmpipe times the first one from the context's
+		// creation otherwise.
+		glBindFramebuffer( GL_FRAMEBUFFER, outputFBO );
+		glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
-		// Bind the VAO.
-		glBindVertexArray( *vertexArrayObject );
+	}
 
-		// Bind the VBO. Watchout for the stride as we are calculating it in bytes (specially when using 
-		// vectors).
-		glBindBuffer( GL_ARRAY_BUFFER, *vertexBufferObject);
-		glBufferData( GL_ARRAY_BUFFER, vertices.size() * sizeof( GLfloat ), vertices.data(), GL_STATIC_DRAW );
+	void resolveUniforms()
+	{
 
-		// Bind the EBO.
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, *elementBufferObject );
-		glBufferData( GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof( GLuint ), indices.data(), 
-					  GL_STATIC_DRAW );
+		uniformsShadow.lightSpaceMatrix = shaderShadow->resolveUniform( "lightSpaceMatrix" );
 
-		// Make sure our attributes match those of other primitives for our G-Buffer pass!
+		uniformsG.viewProjection = shaderG->resolveUniform( "viewProjection" );
+		uniformsG.viewPos = shaderG->resolveUniform( "viewPos" );
+		uniformsG.time = shaderG->resolveUniform( "time" );
 
-		// Position attribute.
-		glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof( GLfloat ), ( void* )( 0 ) );
-		glEnableVertexAttribArray( 0 );
+		uniformsMask.view = shaderMask->resolveUniform( "view" );
+		uniformsMask.invViewProjection = shaderMask->resolveUniform( "invViewProjection" );
+		uniformsMask.lightPos = shaderMask->resolveUniform( "lightPos" );
+		uniformsMask.lightSpaceMatrices = shaderMask->resolveUniform( "lightSpaceMatrices[0]" );
 
-		// Normal attribute.
-		glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof( GLfloat ), ( void* )
-														( 3 * sizeof( GLfloat ) ) );
-		glEnableVertexAttribArray( 1 );
+		uniformsD.viewProjection = shaderD->resolveUniform( "viewProjection" );
+		uniformsD.invViewProjection = shaderD->resolveUniform( "invViewProjection" );
 
-		// Texture Coords attribute.
-		glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof( GLfloat ), ( void* )
-														( 6 * sizeof( GLfloat ) ) );
-		glEnableVertexAttribArray( 2 );
+		uniformsF.view = shaderF->resolveUniform( "view" );
 
-		glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0 );
+		uniformsStencil.view = shaderStencil->resolveUniform( "view" );
+		uniformsStencil.lightIndex = shaderStencil->resolveUniform( "lightIndex" );
+		uniformsStencil.viewPos = -1;
+		uniformsStencil.invViewProjection = -1;
 
 	}
 
-	void renderQuad()
+	// Both permutation sets share the feature bits, the volumes only look at the spotlight and the shadows.
+	void initLightingShaders( const std::string& lightingBase, const std::string& volumeBase )
 	{
-		if (screenQuadVertexArrayObject == 0)
+
+		lightingShaders.init( "lightBuffer.vert", "lightBuffer.frag",
+							  [ lightingBase ]( uint32_t features ) { return lightingBase + lightingDefines( features ); },
+							  [ this ]( Shader& shader, LightingUniforms& uniforms )
 		{
-			float quadVertices[] = {
-				// positions        // texture Coords
-				-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
-				-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-				 1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-				 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-			};
-			// setup plane VAO
-			glGenVertexArrays(1, &screenQuadVertexArrayObject);
-			glGenBuffers(1, &screenQuadVertexBufferObject);
-			glBindVertexArray(screenQuadVertexArrayObject);
-			glBindBuffer(GL_ARRAY_BUFFER, screenQuadVertexBufferObject);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-			glEnableVertexAttribArray(0);
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-			glEnableVertexAttribArray(1);
-			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-		}
-		glBindVertexArray(screenQuadVertexArrayObject);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-		glBindVertexArray(0);
-	}
-
-	void renderCube()
-	{
-		// initialize (if necessary)
-		if (cubeVertexArrayObject == 0)
-		{
-			float vertices[] = {
-				// back face
-				-1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-				 1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-				 1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 0.0f, // bottom-right         
-				 1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-				-1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-				-1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 1.0f, // top-left
-				// front face
-				-1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-				 1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
-				 1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-				 1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-				-1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
-				-1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-				// left face
-				-1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-				-1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
-				-1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-				-1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-				-1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-				-1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-				// right face
-				 1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-				 1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-				 1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right         
-				 1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-				 1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-				 1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left     
-				// bottom face
-				-1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-				 1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
-				 1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-				 1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-				-1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-				-1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-				// top face
-				-1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-				 1.0f,  1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-				 1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right     
-				 1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-				-1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-				-1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left        
-			};
-			glGenVertexArrays(1, &cubeVertexArrayObject);
-			glGenBuffers(1, &cubeVertexBufferObject);
-			// fill buffer
-			glBindBuffer(GL_ARRAY_BUFFER, cubeVertexBufferObject);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-			// link vertex attributes
-			glBindVertexArray(cubeVertexArrayObject);
-			glEnableVertexAttribArray(0);
-			// Position attribute.
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-			glEnableVertexAttribArray(1);
-			// Normal attribute.
-			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-			glEnableVertexAttribArray(2);
-			// Texture coordinates attribute.
-			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			glBindVertexArray(0);
-		}
-		// render Cube
-		glBindVertexArray(cubeVertexArrayObject);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
+
+			shader.setInt( "gDepth", 0 );
+			shader.setInt( "gNormal", 1 );
+			shader.setInt( "gAlbedoSpec", 2 );
+			shader.setInt( "shadowMask", 3 );
+			shader.setInt( "shadowAtlas", SHADOW_ATLAS_UNIT );
+			shader.setInt( "tilesX", ( int )lightCulling.getTilesX() );
+			uniforms.spotPosition = shader.resolveUniform( "spotLight.Position" );
+			uniforms.spotDirection = shader.resolveUniform( "spotLight.RayDirection" );
+			uniforms.spotColour = shader.resolveUniform( "spotLight.Colour" );
+			uniforms.spotCutoff = shader.resolveUniform( "spotLight.Cutoff" );
+			uniforms.spotOuterCutoff = shader.resolveUniform( "spotLight.OuterCutoff" );
+			uniforms.viewPos = shader.resolveUniform( "viewPos" );
+			uniforms.invViewProjection = shader.resolveUniform( "invViewProjection" );
+			uniforms.lightCount = shader.resolveUniform( "lightCount" );
+
+		} );
+
+		volumeShaders.init( "lightVolume.vert", "lightVolume.frag",
+							[ volumeBase ]( uint32_t features ) { return volumeBase + lightingDefines( features ); },
+							[ this ]( Shader& shader, VolumeUniforms& uniforms )
+		{
+
+			shader.setInt( "gDepth", 0 );
+			shader.setInt( "gNormal", 1 );
+			shader.setInt( "gAlbedoSpec", 2 );
+			shader.setInt( "shadowMask", 3 );
+			shader.setInt( "shadowAtlas", SHADOW_ATLAS_UNIT );
+			shader.setMat4( "projection", projection );
+			uniforms.view = shader.resolveUniform( "view" );
+			uniforms.lightIndex = shader.resolveUniform( "lightIndex" );
+			uniforms.viewPos = shader.resolveUniform( "viewPos" );
+			uniforms.invViewProjection = shader.resolveUniform( "invViewProjection" );
+
+		} );
+
 	}
 
-	void free()
+	static std::string lightingDefines( uint32_t features )
 	{
 
-		// Apparently freeing resources is something that the driver must do!
-		// https://community.khronos.org/t/vao-deleting-causes-strange-memory-problems/74691
-		// Free the quad.
-		glDeleteBuffers( 1, &quadVertexBufferObject );
-		glDeleteBuffers( 1, &quadElementBufferObject );
-		glDeleteVertexArrays( 1, &quadVertexArrayObject );
+		std::string defines;
+		defines += features & LIGHTING_TILED ? "#define TILED\n" : "";
+		defines += features & ( LIGHTING_FEW_LIGHTS | LIGHTING_MANY_LIGHTS ) ? "#define POINT_LIGHTS\n" : "";
+		defines += features & LIGHTING_FEW_LIGHTS ? "#define MAX_POINT_LIGHTS " + std::to_string( FEW_LIGHTS ) + "\n" : "";
+		defines += features & LIGHTING_POINT_SHADOWS ? "#define POINT_SHADOWS\n" : "";
+		defines += features & LIGHTING_SPOTLIGHT ? "#define SPOTLIGHT\n" : "";
+		return defines;
 
-		// Free the screen quad.
-		glDeleteBuffers( 1, &screenQuadVertexBufferObject );
-		glDeleteVertexArrays( 1, &screenQuadVertexArrayObject );
+	}
 
-		// Free the cube.
-		glDeleteBuffers( 1, &cubeVertexBufferObject );
-		glDeleteVertexArrays( 1, &cubeVertexArrayObject );
+	// The narrowest lighting program for this many lights: the light volumes draw the point lights
+	// themselves, and without a shadowed light in the atlas there is no atlas to sample.
+	uint32_t lightingFeatures( uint32_t lights, bool pointShadows ) const
+	{
 
-		// Free the depth map.
-		glDeleteTextures( 1, &depthMap );
-		glDeleteFramebuffers( 1, &depthFBO );
+		uint32_t features = scene.spotlight ? LIGHTING_SPOTLIGHT : 0;
+		if( lightingMode != LightingMode::Volumes && lights > 0 )
+		{
 
-		// Free the GBuffer.
-		glDeleteTextures( 1, &gPosition );
-		glDeleteTextures( 1, &gNormal );
-		glDeleteTextures( 1, &gAlbedoSpec );
-		glDeleteFramebuffers( 1, &gBuffer );
+			features |= lights <= FEW_LIGHTS ? LIGHTING_FEW_LIGHTS : LIGHTING_MANY_LIGHTS;
+			features |= lightingMode == LightingMode::Tiled ? LIGHTING_TILED : 0;
+			features |= pointShadows ? LIGHTING_POINT_SHADOWS : 0;
 
-		// Free the decals.
-		glDeleteTextures( 1, &texture1 );
-		glDeleteTextures( 1, &gPositionD );
-		glDeleteTextures( 1, &gNormalD );
-		glDeleteTextures( 1, &gAlbedoSpecD );
-		glDeleteFramebuffers( 1, &gBufferD );
+		}
+		return features;
 
 	}
 
-	// Callbacks
-	static void framebufferResizeCallback( GLFWwindow* window, int width, int height )
+	// One light volume, shadowed or not.
+	uint32_t volumeFeatures( bool shadowed ) const
 	{
 
-		auto app = reinterpret_cast<RenderEngine*>( glfwGetWindowUserPointer( window ) );
-		app->framebufferResized = true;
-
-		glViewport( 0, 0, width, height );
+		return ( scene.spotlight ? LIGHTING_SPOTLIGHT : 0 ) | ( shadowed ? LIGHTING_POINT_SHADOWS : 0 );
 
 	}
 
-	void processInput( GLFWwindow* window )
+	void renderLoop()
 	{
 
-		float camSpeed = deltaTime * SPEED;
+		// The first frame has nothing to overlap with.
+		uint64_t frame = 0;
+		beginPrepare( frames[ 0 ] );
+		jobs.wait( preparing );
 
-		// Close the app when pressing the ESC key.
-		if( glfwGetKey( window, GLFW_KEY_ESCAPE ) == GLFW_PRESS )
+		while( !glfwWindowShouldClose( window ) )
 		{
-		
-			glfwSetWindowShouldClose( window, true );
-		
-		}
 
-		// To keep everything frame rate independent the "tick" is used.
+			// Calculate the time between frames.
+			static auto startTime = std::chrono::high_resolution_clock::now();
 
-		// Move forward. Simple vector addition every scalar in camPos added to every scalar in camFront
-		// "weighted" by the deltaTime to abstract the frame dependency.
-		// Adding two vector gives a sort of average between two vectors.
-		//                 * B
-		//                 ^^
-		//                 | \  camFront
-		//         camPos  |  \
-		//                 |   ^ 
-		//                 |  /
-		//                 | /  camPosOld 
-		//                 |/
-		//                 * A
-		if( glfwGetKey( window, GLFW_KEY_W ) == GLFW_PRESS )
-		{
+			auto currentTime = std::chrono::high_resolution_clock::now();
+			time = std::chrono::duration<float, std::chrono::seconds::period>( currentTime - startTime ).count();
 
-			camPos += camSpeed * camFront;
+			deltaTime = time - lastFrame;
+			lastFrame = time;
 
-		}
+			// User interaction.
+			processInput( window );
 
-		// Same as forward but doing the opposite operation. This 
-		if( glfwGetKey( window, GLFW_KEY_S ) == GLFW_PRESS )
-		{
+			// The next frame gets prepared with this input while we submit the one prepared last time.
+			FrameData& current = frames[ frame % 2 ];
+			beginPrepare( frames[ ( frame + 1 ) % 2 ] );
+
+			profiler.beginFrame();
+			renderFrame( current );
+			profiler.endFrame();
+
+			glfwSwapBuffers( window );
+			glfwPollEvents();
+			if( frame == 0 )
+			{
+
+				reportFirstFrame();
+
+			}
+
+			jobs.wait( preparing );
+			updateResolution();
+			++frame;
+
+		}
+
+		profiler.flush();
+		profiler.dump( std::cout );
+		GLObjects::dump( std::cout );
+
+		// Don't leak!
+		free();
+		reportLeaks();
+		glfwTerminate();
+
+	}
+
+	void benchmarkLoop( const BenchmarkSettings& settings )
+	{
+
+		Benchmark bench( settings );
+		bench.init( profiler );
+
+		// No wall clock here, the frame index drives everything so every run renders the same frames.
+		auto inputsAt = [ & ]( uint32_t frame )
+		{
+
+			time = bench.timeAt( frame );
+			deltaTime = time - lastFrame;
+			lastFrame = time;
+			bench.cameraAt( time, camPos, camFront );
+
+		};
+
+		inputsAt( 0 );
+		beginPrepare( frames[ 0 ] );
+		jobs.wait( preparing );
+		for( uint32_t frame = 0; frame < settings.frames; ++frame )
+		{
+
+			// Same pipelining as the interactive loop, the frame time includes waiting for the next
+			// frame's preparation.
+			if( frame + 1 < settings.frames )
+			{
+
+				inputsAt( frame + 1 );
+				beginPrepare( frames[ ( frame + 1 ) % 2 ] );
+
+			}
+
+			bench.beginFrame();
+			profiler.beginFrame();
+			renderFrame( frames[ frame % 2 ] );
+			profiler.endFrame();
+			jobs.wait( preparing );
+			updateResolution();
+			bench.endFrame();
+			if( frame == 0 )
+			{
+
+				reportFirstFrame();
+
+			}
+
+		}
+		bench.setStartup( startup );
+
+		profiler.flush();
+		profiler.dump( std::cout );
+		GLObjects::dump( std::cout );
+		// Grab everything we need from the context before free() releases it, the report also says
+		// whether free() left something behind.
+		std::string renderer = ( const char* )glGetString( GL_RENDERER );
+		if( !settings.capturePath.empty() )
+		{
+
+			std::vector<unsigned char> pixels( ( size_t )outputWidth * outputHeight * 3 );
+			glBindFramebuffer( GL_READ_FRAMEBUFFER, outputFBO );
+			glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+			glReadPixels( 0, 0, outputWidth, outputHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data() );
+			bench.writeCapture( outputWidth, outputHeight, pixels );
+
+		}
+
+		profiler.onResolved = nullptr;
+		free();
+		reportLeaks();
+		bench.released();
+		bench.writeJson( renderer, outputWidth, outputHeight );
+		headless.destroy();
+
+	}
+
+	// Warm launches should spend next to nothing on the programs, everything comes from the cache.
+	void reportStartup()
+	{
+
+		startup.totalMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now() - launched ).count();
+		std::cout << "Startup " << startup.totalMs << "ms, programs " << startup.programsMs << "ms: "
+				  << startup.cachedPrograms << " from the cache, " << startup.compiledPrograms << " compiled"
+				  << ( startup.parallelCompile ? " in parallel" : "" ) << std::endl;
+
+	}
+
+	// From the launch to the first frame on screen, textures still streaming don't hold it back.
+	void reportFirstFrame()
+	{
+
+		startup.firstFrameMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now() - launched ).count();
+		std::cout << "First frame after " << startup.firstFrameMs << "ms, " << streamer.streaming() << " textures still streaming"
+				  << std::endl;
+
+	}
+
+	// Everything should be gone after free(), say so loudly when it isn't.
+	void reportLeaks()
+	{
+
+		if( GLObjects::total() != 0 )
+		{
+
+			std::cerr << "Leaked ";
+			GLObjects::dump( std::cerr );
+
+		}
+
+	}
+
+	// Submits a frame that the job system already prepared, only GL work and uploads in here. The passes
+	// themselves are in the render graph, see buildRenderGraph().
+	void renderFrame( const FrameData& frame )
+	{
+
+		uploadFrame( frame );
+		streamer.update();
+
+		// The passes only change with the lighting mode and with whether we upscale.
+		if( !graphBuilt || graphLighting != lightingMode || graphUpscaled != upscaled() )
+		{
+
+			buildRenderGraph();
+
+		}
+
+		submitting = &frame;
+		// Everything after the G-buffer pass gets positions back from the depth.
+		invViewProjection = glm::inverse( projection * frame.view );
+		targets.beginFrame();
+		graph.setRenderSize( renderWidth, renderHeight );
+		graph.setFramebuffer( output, outputFBO, outputWidth, outputHeight );
+		graph.execute();
+		submitting = nullptr;
+
+		// Nothing reads this frame's lights anymore.
+		lightBuffer.endFrame();
+		targets.endFrame();
+		profiler.setCounter( COUNTER_TARGETS_PEAK_MB, targets.peakBytes() / ( 1024.0 * 1024.0 ) );
+		profiler.setCounter( COUNTER_TARGETS_MB, targets.allocatedBytes() / ( 1024.0 * 1024.0 ) );
+		profiler.setCounter( COUNTER_BINDS, ( double )GLState::issuedBinds() );
+		profiler.setCounter( COUNTER_REDUNDANT_BINDS, ( double )GLState::skippedBinds() );
+		profiler.setCounter( COUNTER_SHADER_VARIANTS, ( double )( lightingShaders.size() + volumeShaders.size() ) );
+		profiler.setCounter( COUNTER_STREAM_KB, streamer.uploadedBytes() / 1024.0 );
+		profiler.setCounter( COUNTER_STREAMING_TEXTURES, ( double )streamer.streaming() );
+		GLState::resetCounts();
+
+	}
+
+	// Every pass of a frame along with what it reads and writes. The graph binds, clears, acquires and
+	// releases for them, and drops the ones nothing ends up reading (the light culling outside tiled
+	// lighting). Everything up to the upscale is drawn at the render size.
+	void buildRenderGraph()
+	{
+
+		graph.reset();
+		graphLighting = lightingMode;
+		graphUpscaled = upscaled();
+		graphBuilt = true;
+		bool volumes = lightingMode == LightingMode::Volumes;
+
+		output = graph.importFramebuffer( "output" );
+		graph.markOutput( output );
+		RenderResource shadowMaps = graph.importResource( "shadowMaps" );
+		RenderResource atlas = graph.importResource( "shadowAtlas" );
+		RenderResource lightTiles = graph.importResource( "lightTiles" );
+
+		// Kept as small as we can, this gets written and read for every pixel: no position (the depth
+		// texture and the inverse view projection give it back) and two 16 bit octahedral normal
+		// components instead of four half floats. The shadows are resolved in their own pass afterwards.
+		// 12 bytes per pixel instead of 24. The depth has stencil for the light volumes.
+		gNormal = graph.createTarget( "gNormal", GL_RG16 );
+		gAlbedoSpec = graph.createTarget( "gAlbedoSpec", GL_RGBA8 );
+		gDepth = graph.createTarget( "gDepth", GL_DEPTH24_STENCIL8 );
+		shadowMask = graph.createTarget( "shadowMask", GL_R8 );
+		lightAccum = graph.createTarget( "lightAccum", GL_RGBA16F );
+		lightAccumDepth = graph.createTarget( "lightAccumDepth", GL_DEPTH24_STENCIL8, true );
+		sceneColour = graph.createTarget( "sceneColour", GL_RGBA8 );
+
+		graph.addPass( "shadow", PASS_SHADOW, [ this ]() { renderShadowMaps( *submitting ); } )
+			 .write( shadowMaps );
+		graph.addPass( "atlas", PASS_SHADOW_ATLAS, [ this ]() { renderShadowAtlas( *submitting ); } )
+			 .write( atlas );
+
+		// The pre-pass attaches the whole G-buffer so the G-buffer pass finds it bound and cleared.
+		if( scene.depthPrepass )
+		{
+
+			graph.addPass( "prepass", PASS_DEPTH_PREPASS, [ this ]() { renderDepthPrepass( *submitting ); } )
+				 .colour( gNormal ).colour( gAlbedoSpec ).depth( gDepth );
+
+		}
+		graph.addPass( "gbuffer", PASS_GBUFFER, [ this ]() { renderGBuffer( *submitting ); } )
+			 .colour( gNormal ).colour( gAlbedoSpec ).depth( gDepth );
+
+		// The depth only gets read, it isn't attached.
+		if( decals.size() > 0 )
+		{
+
+			graph.addPass( "decals", PASS_DECALS, [ this ]() { renderDecals( *submitting ); } )
+				 .sample( gDepth, 0 ).colour( gNormal ).colour( gAlbedoSpec );
+
+		}
+
+		// Without the spotlight nothing reads its shadows, the graph drops the cascades too.
+		if( scene.spotlight )
+		{
+
+			graph.addPass( "shadowmask", PASS_SHADOW_MASK, [ this ]() { renderShadowMask( *submitting ); } )
+				 .sample( gDepth, 0 ).sample( gNormal, 1 ).read( shadowMaps ).colour( shadowMask, Coverage::Full );
+
+		}
+		graph.addPass( "culling", PASS_LIGHT_CULLING, [ this ]() { cullLights(); } )
+			 .sample( gDepth, 0 ).write( lightTiles );
+
+		// The lit image goes straight to the output unless it needs stretching over it or the light volumes
+		// have to add up in half floats first, it discards the sky so it gets cleared.
+		RenderGraph::Pass& lighting = graph.addPass( "lighting", PASS_LIGHTING, [ this ]() { renderLighting( *submitting ); } )
+			 .sample( gDepth, 0 ).sample( gNormal, 1 ).sample( gAlbedoSpec, 2 ).read( atlas );
+		if( scene.spotlight )
+		{
+
+			lighting.sample( shadowMask, 3 );
+
+		}
+
+		if( lightingMode == LightingMode::Tiled )
+		{
+
+			lighting.read( lightTiles );
+
+		}
+
+		if( volumes )
+		{
+
+			// renderLightVolumes() copies the G-buffer's depth over the whole depth target.
+			lighting.colour( lightAccum ).depth( lightAccumDepth, Coverage::Full );
+
+		}
+
+		else
+		{
+
+			lighting.colour( graphUpscaled ? sceneColour : output );
+
+		}
+
+		if( volumes || graphUpscaled )
+		{
+
+			RenderResource lit = volumes ? lightAccum : sceneColour;
+			graph.addPass( "upscale", PASS_UPSCALE, [ this, lit ]() { upscale( lit ); } )
+				 .read( lit ).write( output );
+
+		}
+
+		graph.addPass( "forward", PASS_FORWARD, [ this ]() { renderForward( *submitting ); } )
+			 .read( gDepth ).colour( output );
+
+		graph.compile();
+
+	}
+
+	// Shadow Map
+	// To be able to render the shadow map, we are going to pre-render the scene from the light (in 
+	// this case a spot light), the screen space shadow pass compares every pixel against it and the
+	// light pass multiplies our final colour by the result to get our shadows.
+	// Render the shadow map, one layer per cascade with only the objects that cascade can see.
+	void renderShadowMaps( const FrameData& frame )
+	{
+
+		shaderShadow->use();
+
+		// We have a different resolution for our shadow map, for optimization reasons, the cascades set
+		// the viewport to it. The still casters are only drawn when their cached layer went stale, the
+		// moving ones go on top of a copy of it.
+		for( uint32_t i = 0; i < shadowCascades.count(); ++i )
+		{
+
+			shaderShadow->setMat4( uniformsShadow.lightSpaceMatrix, frame.lightSpaces[i] );
+			if( frame.refreshShadows[i] )
+			{
+
+				shadowCascades.beginStill( i );
+				renderScene( stillShadowObjects[i], frame.ground );
+
+			}
+
+			if( shadowCascades.beginMoving( i, frame.refreshShadows[i], shadowObjects[i].count > 0 ) )
+			{
+
+				renderCubes( shadowObjects[i].vertexArrayObject, shadowObjects[i].count );
+
+			}
+
+		}
+
+	}
+
+	// The point lights' shadows, same shader, every cube face into its own tile of the atlas.
+	void renderShadowAtlas( const FrameData& frame )
+	{
+
+		if( !frame.atlasViews.empty() )
+		{
+
+			shaderShadow->use();
+			shadowAtlas.begin();
+			for( uint32_t i = 0; i < frame.atlasViews.size(); ++i )
+			{
+
+				shadowAtlas.bindTile( frame.atlasTiles[i] );
+				shaderShadow->setMat4( uniformsShadow.lightSpaceMatrix, frame.atlasViews[i].viewProjection );
+				renderCubes( atlasObjects.vertexArrayObject, atlasRanges[i].count, atlasRanges[i].first );
+				renderGround( frame.ground );
+
+			}
+
+		}
+
+	}
+
+	// Optional depth only pass with the shadow shader, the G-buffer pass after it only keeps the
+	// fragments that match, every pixel gets its material written once however many cubes cover it.
+	void renderDepthPrepass( const FrameData& frame )
+	{
+
+		glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+		shaderShadow->use();
+		shaderShadow->setMat4( uniformsShadow.lightSpaceMatrix, projection * frame.view );
+		renderScene( cameraObjects, frame.ground );
+		glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+		glDepthFunc( GL_EQUAL );
+		glDepthMask( GL_FALSE );
+
+	}
+
+	// 1st pass, this is when the geometry is added into the gBuffer.
+	void renderGBuffer( const FrameData& frame )
+	{
+
+		// Don't forget to activate, set the shader's index when adding uniforms!
+		shaderG->use();
+		shaderG->setMat4( uniformsG.viewProjection, projection * frame.view );
+		shaderG->setVec3( uniformsG.viewPos, frame.camPos );
+		shaderG->setFloat( uniformsG.time, frame.time );
+		profiler.beginFragments( COUNTER_GBUFFER_FRAGMENTS );
+		renderScene( cameraObjects, frame.ground );
+		profiler.endFragments();
+		glDepthFunc( GL_LESS );
+		glDepthMask( GL_TRUE );
+
+	}
+
+	// The decals go over the G-buffer's albedo and normal, the boxes' back faces are drawn without a depth
+	// test so the camera can be inside one. The specular stays what the surface had.
+	void renderDecals( const FrameData& frame )
+	{
+
+		shaderD->use();
+		shaderD->setMat4( uniformsD.viewProjection, projection * frame.view );
+		shaderD->setMat4( uniformsD.invViewProjection, invViewProjection );
+		GLState::bindTexture( 1, GL_TEXTURE_2D, streamer.texture( decalTexture ) );
+		glDisable( GL_DEPTH_TEST );
+		glEnable( GL_CULL_FACE );
+		glCullFace( GL_FRONT );
+		glEnable( GL_BLEND );
+		glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+		glColorMaski( 1, GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE );
+		decals.draw( meshes, cube );
+		glColorMaski( 1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+		glDisable( GL_BLEND );
+		glCullFace( GL_BACK );
+		glDisable( GL_CULL_FACE );
+		glEnable( GL_DEPTH_TEST );
+
+	}
+
+	// Shadows, once per pixel that ended up visible.
+	void renderShadowMask( const FrameData& frame )
+	{
+
+		shaderMask->use();
+		shaderMask->setMat4( uniformsMask.view, frame.view );
+		shaderMask->setMat4( uniformsMask.invViewProjection, invViewProjection );
+		shaderMask->setVec3( uniformsMask.lightPos, frame.lightPos );
+		shaderMask->setMat4Array( uniformsMask.lightSpaceMatrices, frame.lightSpaces, ( GLsizei )shadowCascades.count() );
+		shadowCascades.bindTextures( SHADOW_COMPARE_UNIT, SHADOW_DEPTH_UNIT );
+		glDisable( GL_DEPTH_TEST );
+		meshes.draw( screenQuad );
+		glEnable( GL_DEPTH_TEST );
+		shadowCascades.unbindTextures( SHADOW_COMPARE_UNIT, SHADOW_DEPTH_UNIT );
+
+	}
+
+	// Bin the lights into screen tiles using the G-buffer we just wrote.
+	void cullLights()
+	{
+
+		lightCulling.dispatch( lightCount, renderWidth, renderHeight, invViewProjection );
+
+	}
+
+	// 2nd pass, this is when the lighting is calculated by the lightBuffer.frag shader.
+	void renderLighting( const FrameData& frame )
+	{
+
+		shadowAtlas.bindTexture( SHADOW_ATLAS_UNIT );
+		// With light volumes the full screen pass only adds the ambient term and the spotlight.
+		auto& lighting = lightingShaders.get( lightingFeatures( lightCount, !frame.atlasViews.empty() ) );
+		Shader& shader = *lighting.shader;
+		const LightingUniforms& uniforms = lighting.uniforms;
+		shader.use();
+
+		// Send the spotlight.
+		shader.setVec3( uniforms.spotPosition, frame.lightPos );
+		shader.setVec3( uniforms.spotDirection, frame.lightDir );
+		shader.setVec3( uniforms.spotColour, lightCol );
+		shader.setFloat( uniforms.spotCutoff, glm::cos( glm::radians( 12.5f ) ) );
+		shader.setFloat( uniforms.spotOuterCutoff, glm::cos( glm::radians( 17.5f ) ) );
+		shader.setInt( uniforms.lightCount, ( int )lightCount );
+
+		// Send the camera.
+		shader.setVec3( uniforms.viewPos, frame.camPos );
+		shader.setMat4( uniforms.invViewProjection, invViewProjection );
+
+		// The quad covers everything anyway, and with light volumes the bound depth is the G-buffer's
+		// which it must not overwrite. It discards the sky, what it lets through is what the geometry covers.
+		glDisable( GL_DEPTH_TEST );
+		profiler.beginFragments( COUNTER_COVERED_PIXELS );
+		meshes.draw( screenQuad );
+		profiler.endFragments();
+		glEnable( GL_DEPTH_TEST );
+
+		if( lightingMode == LightingMode::Volumes )
+		{
+
+			renderLightVolumes( frame );
+
+		}
+
+	}
+
+	// The lit image goes to the output, bilinear filtered when it is smaller. The light volumes always
+	// go through here, they add up in half floats and get clamped to the output's 8 bits only now.
+	void upscale( RenderResource lit )
+	{
+
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, targets.framebuffer( { graph.target( lit ) }, RenderTarget() ) );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, outputFBO );
+		glBlitFramebuffer( 0, 0, renderWidth, renderHeight, 0, 0, outputWidth, outputHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR );
+
+	}
+
+	// Add the depth buffer data to the default framebuffers' depth buffer. So that we can properly
+	// merge the deferred renderer with a normal forward renderer, this forward renderer will only
+	// render lights as very bright colours, nothing fancy yet.
+	void renderForward( const FrameData& frame )
+	{
+
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, targets.framebuffer( nullptr, 0, graph.target( gDepth ) ) );
+		glBlitFramebuffer( 0, 0, renderWidth, renderHeight, 0, 0, outputWidth, outputHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST );
+
+		// 3rd pass, through a forward render add lights representation to the scene.
+		shaderF->use();
+		shaderF->setMat4( uniformsF.view, frame.view );
+
+		// Every gizmo in one go.
+		renderCubes( gizmoCubeVertexArrayObject, ( GLsizei )gizmoCount );
+
+	}
+
+	// Adds every point light on top of the lit scene by drawing its bounding sphere twice: first into
+	// the stencil only, back faces behind the scene increment it and front faces behind the scene
+	// decrement it, so only pixels whose surface is inside the sphere end up non zero. Then the back
+	// faces (they are still there with the camera inside the light) shade exactly those pixels and
+	// reset the stencil to zero for the next light, so we never have to clear it in between.
+	// Expects the light accumulation target bound, the upscale pass copies it to the output.
+	void renderLightVolumes( const FrameData& frame )
+	{
+
+		// The stencil test needs the scene's depth, we can't use the G-buffer's own since it is bound
+		// as a texture.
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, targets.framebuffer( nullptr, 0, graph.target( gDepth ) ) );
+		glBlitFramebuffer( 0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST );
+		glClear( GL_STENCIL_BUFFER_BIT );
+
+		shaderStencil->use();
+		shaderStencil->setMat4( uniformsStencil.view, frame.view );
+		// Shadowed lights get the variant that samples the atlas, the others the one that doesn't.
+		ShaderPermutations<VolumeUniforms>::Variant* volumes[2] = { &volumeShaders.get( volumeFeatures( false ) ), nullptr };
+		if( !frame.atlasViews.empty() )
+		{
+
+			volumes[1] = &volumeShaders.get( volumeFeatures( true ) );
+
+		}
+
+		for( auto* volume : volumes )
+		{
+
+			if( volume )
+			{
+
+				volume->shader->use();
+				volume->shader->setMat4( volume->uniforms.view, frame.view );
+				volume->shader->setVec3( volume->uniforms.viewPos, frame.camPos );
+				volume->shader->setMat4( volume->uniforms.invViewProjection, invViewProjection );
+
+			}
+
+		}
+
+		glEnable( GL_STENCIL_TEST );
+		glDepthMask( GL_FALSE );
+		glBlendFunc( GL_ONE, GL_ONE );
+		glCullFace( GL_FRONT );
+
+		for( uint32_t i = 0; i < lightCount; ++i )
+		{
+
+			// Mark the volume.
+			shaderStencil->use();
+			shaderStencil->setInt( uniformsStencil.lightIndex, ( int )i );
+			glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+			glEnable( GL_DEPTH_TEST );
+			glDisable( GL_CULL_FACE );
+			glDisable( GL_BLEND );
+			glStencilFunc( GL_ALWAYS, 0, 0 );
+			glStencilOpSeparate( GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP );
+			glStencilOpSeparate( GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP );
+			meshes.draw( sphere );
+
+			// Shade what we marked.
+			const auto* volume = volumes[ frame.lights[i].shadow >= 0 ? 1 : 0 ];
+			volume->shader->use();
+			volume->shader->setInt( volume->uniforms.lightIndex, ( int )i );
+			glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+			glDisable( GL_DEPTH_TEST );
+			glEnable( GL_CULL_FACE );
+			glEnable( GL_BLEND );
+			glStencilFunc( GL_NOTEQUAL, 0, 0xFF );
+			glStencilOp( GL_ZERO, GL_ZERO, GL_ZERO );
+			meshes.draw( sphere );
+
+		}
+
+		glCullFace( GL_BACK );
+		glDisable( GL_CULL_FACE );
+		glDisable( GL_BLEND );
+		glDisable( GL_STENCIL_TEST );
+		glEnable( GL_DEPTH_TEST );
+		glDepthMask( GL_TRUE );
+
+	}
+
+	// A target as big as the render size.
+	RenderTargetDesc renderTarget( GLenum format, bool attachmentOnly = false ) const
+	{
+
+		RenderTargetDesc desc;
+		desc.width = renderWidth;
+		desc.height = renderHeight;
+		desc.format = format;
+		desc.attachmentOnly = attachmentOnly;
+		return desc;
+
+	}
+
+	// Whether the lighting renders smaller than the output and needs stretching over it.
+	bool upscaled() const
+	{
+
+		return renderWidth != outputWidth || renderHeight != outputHeight;
+
+	}
+
+	// Snapshots the inputs the frame depends on and hands it to the job system, jobs.wait( preparing )
+	// before reading it.
+	void beginPrepare( FrameData& frame )
+	{
+
+		frame.time = time;
+		frame.camPos = camPos;
+		frame.camFront = camFront;
+		frame.lightPos = lightPos;
+		jobs.run( preparing, [ this, &frame ]() { prepareFrame( frame ); } );
+
+	}
+
+	// Runs on the job system, everything it reads is either in frame or only ever written by another
+	// prepareFrame, and those never overlap.
+	void prepareFrame( FrameData& frame )
+	{
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// Create the camera (eye).
+		frame.view = glm::lookAt( frame.camPos, frame.camPos + frame.camFront, camUp );
+
+		// This is realtime so why not?
+		// Calculate a vector from the parametric equation of a circle so that our spotlight can be directed
+		// radially.
+		// Uncomment the following lines for a moving spotlight.
+		//frame.lightDir -= glm::vec3( 1.f * sin( frame.time * 0.8 ), 0.0f, 1.0f * cos( frame.time * 0.8 ) );
+		//frame.lightDir = glm::normalize( frame.lightDir );
+		frame.lightDir = frame.camFront;
+		glm::mat4 lightView = glm::lookAt( frame.lightPos, frame.lightPos + frame.lightDir, glm::vec3( 0.0f, 1.0f, 0.0f ) );
+		shadowCascades.fit( frame.view, lightView, frame.lightSpaces );
+
+		// Everything that moves does so before the first pass, then every pass draws the same matrices.
+		animateLights( frame );
+		animateObjects( frame );
+		// Nothing moves the still casters in this scene, but whoever does gets their shadows redrawn.
+		bool stillMoved = transforms.changed( firstStill, ground + 1 - firstStill );
+		frame.decalsMoved = transforms.changed( firstDecal, ( uint32_t )frame.decals.size() );
+		transforms.update( &jobs );
+
+		refitObjects( movingBvh, firstObject );
+		if( stillMoved )
+		{
+
+			refitObjects( stillBvh, firstStill );
+			shadowCascades.invalidate();
+
+		}
+
+		frame.ground = transforms.worldMatrix( ground );
+		frame.gizmos.assign( transforms.worldMatrices() + firstGizmo, transforms.worldMatrices() + firstGizmo + gizmoCount );
+		if( frame.decalsMoved )
+		{
+
+			DecalBatch::build( transforms.worldMatrices() + firstDecal, ( uint32_t )frame.decals.size(), frame.decals.data() );
+
+		}
+
+		planShadowAtlas( frame );
+
+		// Every view at the same time.
+		JobSystem::Group culling;
+		for( uint32_t i = 0; i < shadowCascades.count(); ++i )
+		{
+
+			frame.refreshShadows[i] = shadowCascades.stale( i, frame.lightSpaces[i] );
+			bool refresh = frame.refreshShadows[i];
+			jobs.run( culling, [ &, i ]() { cullObjects( frame.lightSpaces[i], true, false, frame.shadowObjects[i] ); } );
+			jobs.run( culling, [ &, i, refresh ]() { cullObjects( frame.lightSpaces[i], false, refresh, frame.stillShadowObjects[i] ); } );
+
+		}
+		jobs.run( culling, [ & ]() { cullObjects( projection * frame.view, true, true, frame.cameraObjects ); } );
+		for( uint32_t i = 0; i < frame.atlasViews.size() / ShadowAtlas::FACES; ++i )
+		{
+
+			jobs.run( culling, [ &, i ]()
+			{
+
+				for( uint32_t view = i * ShadowAtlas::FACES; view < ( i + 1 ) * ShadowAtlas::FACES; ++view )
+				{
+
+					cullObjects( frame.atlasViews[ view ].viewProjection, true, true, frame.atlasObjects[ view ] );
+
+				}
+
+			} );
+
+		}
+		jobs.wait( culling );
+
+		frame.prepareMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now() - start ).count();
+
+	}
+
+	// Below this many elements a job costs more than it saves.
+	static constexpr uint32_t PARALLEL_GRAIN = 1024;
+
+	// Only the boxes move, the tree keeps its shape and gets refit.
+	void refitObjects( Bvh& bvh, Entity first )
+	{
+
+		Aabb* boxes = bvh.boxes();
+		jobs.parallelFor( bvh.size(), PARALLEL_GRAIN, [ & ]( uint32_t begin, uint32_t end )
+		{
+
+			for( uint32_t i = begin; i < end; ++i )
+			{
+
+				boxes[i] = Aabb::fromUnitCube( transforms.worldMatrix( first + i ) );
+
+			}
+
+		} );
+		bvh.refitAll();
+
+	}
+
+	// Picks the point lights that cast shadows this frame and where their faces go in the atlas. Only the
+	// lights the camera sees count, the ones that cover more of the screen first.
+	void planShadowAtlas( FrameData& frame )
+	{
+
+		Frustum camera( projection * frame.view );
+		frame.shadowCandidates.clear();
+		for( uint32_t i = 0; i < frame.lights.size(); ++i )
+		{
+
+			const GpuLight& light = frame.lights[i];
+			if( !camera.touches( light.position, light.radius ) )
+			{
+
+				continue;
+
+			}
+
+			// The sphere's diameter on screen, all of it once the camera is inside.
+			float distance = glm::length( light.position - frame.camPos );
+			float pixels = distance <= light.radius ? renderHeight : std::min( light.radius / distance * projection[1][1], 1.0f ) * renderHeight;
+			frame.shadowCandidates.push_back( { pixels, i } );
+
+		}
+
+		uint32_t count = std::min( ( uint32_t )frame.shadowCandidates.size(), shadowAtlas.maxLights() );
+		std::partial_sort( frame.shadowCandidates.begin(), frame.shadowCandidates.begin() + count,
+						   frame.shadowCandidates.end(), std::greater<std::pair<float, uint32_t>>() );
+		uint32_t sizes[ ShadowAtlas::MAX_LIGHTS ];
+		for( uint32_t i = 0; i < count; ++i )
+		{
+
+			sizes[i] = shadowAtlas.tileSize( frame.shadowCandidates[i].first );
+
+		}
+
+		frame.atlasTiles.resize( count * ShadowAtlas::FACES );
+		count = shadowAtlas.pack( sizes, count, frame.atlasTiles.data() );
+		frame.atlasTiles.resize( count * ShadowAtlas::FACES );
+		frame.atlasViews.resize( count * ShadowAtlas::FACES );
+		for( uint32_t i = 0; i < count; ++i )
+		{
+
+			GpuLight& light = frame.lights[ frame.shadowCandidates[i].second ];
+			light.shadow = ( int32_t )( i * ShadowAtlas::FACES );
+			shadowAtlas.faces( light.position, light.radius, &frame.atlasTiles[ light.shadow ], &frame.atlasViews[ light.shadow ] );
+
+		}
+
+	}
+
+	// Moves the point lights and their gizmos, the first gizmo belongs to the spotlight.
+	void animateLights( FrameData& frame )
+	{
+
+		transforms.setPosition( firstGizmo, frame.lightPos );
+		PositionSpan gizmos = transforms.editPositions( firstGizmo + 1, ( uint32_t )lightPositions.size() );
+		frame.lights.resize( lightPositions.size() );
+		jobs.parallelFor( ( uint32_t )lightPositions.size(), PARALLEL_GRAIN, [ & ]( uint32_t begin, uint32_t end )
+		{
+
+			for( uint32_t i = begin; i < end; ++i )
+			{
+
+				// We are reusing so only compute once.
+				float c = 1.0f + 1.2f * ( i % LIGHT_RINGS );
+				float t = frame.time * 0.5f + i;
+
+				lightPositions[i] = glm::vec3( c * sin( t ), 1.0f, c * cos( t ) );
+				gizmos.x[i] = lightPositions[i].x;
+				gizmos.y[i] = lightPositions[i].y;
+				gizmos.z[i] = lightPositions[i].z;
+				GpuLight& light = frame.lights[i];
+				light.position = lightPositions[i];
+				light.radius = lightRadii[i];
+				light.colour = lightColours[i];
+				light.linear = linear;
+				light.quadratic = quadratic;
+				light.shadow = -1;
+
+			}
+
+		} );
+
+	}
+
+	// Only the objects bob, they only move up and down so that is the only component we touch.
+	void animateObjects( const FrameData& frame )
+	{
+
+		PositionSpan objects = transforms.editPositions( firstObject, ( uint32_t )objectRestHeights.size() );
+		jobs.parallelFor( ( uint32_t )objectRestHeights.size(), PARALLEL_GRAIN, [ & ]( uint32_t begin, uint32_t end )
+		{
+
+			for( uint32_t i = begin; i < end; ++i )
+			{
+
+				objects.y[i] = objectRestHeights[i] + sin( frame.time * 0.1f + i ) + 1.0f;
+
+			}
+
+		} );
+
+	}
+
+	// Collects the moving and/or still objects inside viewProjection's frustum front to back, so the depth
+	// test rejects as much as it can, and packs their matrices in that order.
+	void cullObjects( const glm::mat4& viewProjection, bool moving, bool still, DrawList& list )
+	{
+
+		Frustum frustum( viewProjection );
+		list.indices.clear();
+		if( moving )
+		{
+
+			movingBvh.cull( frustum, list.indices );
+
+		}
+		if( still )
+		{
+
+			stillBvh.cull( frustum, list.indices, firstStill - firstObject );
+
+		}
+
+		// Sorted on the view depth of their centres, clip space w is the view's last row times the position.
+		glm::vec4 depthRow( viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3] );
+		std::vector<std::pair<float, uint32_t>>& order = list.order;
+		order.resize( list.indices.size() );
+		for( uint32_t i = 0; i < list.indices.size(); ++i )
+		{
+
+			glm::vec4 centre = transforms.worldMatrix( firstObject + list.indices[i] )[3];
+			order[i] = { glm::dot( depthRow, centre ), list.indices[i] };
+
+		}
+		std::sort( order.begin(), order.end() );
+
+		list.matrices.resize( order.size() );
+		for( uint32_t i = 0; i < order.size(); ++i )
+		{
+
+			list.indices[i] = order[i].second;
+			list.matrices[i] = transforms.worldMatrix( firstObject + order[i].second );
+
+		}
+
+	}
+
+	// Everything the passes draw from goes to the GPU up front.
+	void uploadFrame( const FrameData& frame )
+	{
+
+		// The whole light list goes to the GPU in one go, both the culling and the lighting read it.
+		lightCount = lightBuffer.upload( frame.lights.data(), ( uint32_t )frame.lights.size() );
+		uploadInstances( gizmoInstanceBufferObject, frame.gizmos.data(), frame.gizmos.size() * sizeof( glm::mat4 ) );
+		if( frame.decalsMoved )
+		{
+
+			decals.upload( frame.decals.data(), ( uint32_t )frame.decals.size() );
+
+		}
+		uploadVisible( frame.cameraObjects, cameraObjects );
+		profiler.setCounter( COUNTER_RESOLUTION_SCALE, dynamicResolution.scale() );
+		profiler.setCounter( COUNTER_CAMERA_DRAWN, cameraObjects.count );
+		profiler.setCounter( COUNTER_CAMERA_CULLED, ( double )scene.objects - cameraObjects.count );
+
+		// The shadow counters add up every cascade, an object two cascades see is drawn twice. The still
+		// objects only count in the cascades that drew them again.
+		double shadowDrawn = 0.0, shadowTested = 0.0, refreshed = 0.0;
+		for( uint32_t i = 0; i < shadowCascades.count(); ++i )
+		{
+
+			uploadVisible( frame.shadowObjects[i], shadowObjects[i] );
+			shadowDrawn += shadowObjects[i].count;
+			shadowTested += movingBvh.size();
+			if( frame.refreshShadows[i] )
+			{
+
+				uploadVisible( frame.stillShadowObjects[i], stillShadowObjects[i] );
+				shadowDrawn += stillShadowObjects[i].count;
+				shadowTested += stillBvh.size();
+				refreshed += 1.0;
+
+			}
+
+		}
+		profiler.setCounter( COUNTER_SHADOW_DRAWN, shadowDrawn );
+		profiler.setCounter( COUNTER_SHADOW_CULLED, shadowTested - shadowDrawn );
+		profiler.setCounter( COUNTER_SHADOW_REFRESHED, refreshed );
+
+		// Every atlas face's casters one after the other.
+		atlasMatrices.clear();
+		atlasRanges.clear();
+		for( uint32_t i = 0; i < frame.atlasViews.size(); ++i )
+		{
+
+			const std::vector<glm::mat4>& matrices = frame.atlasObjects[i].matrices;
+			atlasRanges.push_back( { ( GLuint )atlasMatrices.size(), ( GLsizei )matrices.size() } );
+			atlasMatrices.insert( atlasMatrices.end(), matrices.begin(), matrices.end() );
+
+		}
+		uploadInstances( atlasObjects.instanceBufferObject, atlasMatrices.data(), atlasMatrices.size() * sizeof( glm::mat4 ) );
+		shadowAtlas.upload( frame.atlasViews.data(), ( uint32_t )frame.atlasViews.size() );
+		profiler.setCounter( COUNTER_ATLAS_LIGHTS, ( double )frame.atlasViews.size() / ShadowAtlas::FACES );
+		profiler.setCounter( COUNTER_ATLAS_DRAWN, ( double )atlasMatrices.size() );
+		profiler.setCounter( COUNTER_PREPARE_MS, frame.prepareMs );
+
+	}
+
+	void uploadVisible( const DrawList& list, VisibleObjects& objects )
+	{
+
+		objects.count = ( GLsizei )list.matrices.size();
+		uploadInstances( objects.instanceBufferObject, list.matrices.data(), list.matrices.size() * sizeof( glm::mat4 ) );
+
+	}
+
+	// The shader only has to be bound, the model matrices come from the instance buffer.
+	void renderScene( const VisibleObjects& objects, const glm::mat4& groundModel )
+	{
+
+		renderCubes( objects.vertexArrayObject, objects.count );
+		renderGround( groundModel );
+
+	}
+
+	void renderGround( const glm::mat4& groundModel )
+	{
+
+		// The ground is a single quad, its VAO doesn't enable the instance attributes so the shader reads
+		// the current constant values instead, one per matrix column.
+		for( GLuint column = 0; column < 4; ++column )
+		{
+
+			glVertexAttrib4fv( 3 + column, glm::value_ptr( groundModel[column] ) );
+
+		}
+		meshes.draw( groundQuad );
+
+	}
+
+	// Orphans last frame's storage so we never wait on the GPU still drawing from it.
+	void uploadInstances( GLuint buffer, const void* data, size_t size )
+	{
+
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		glBufferData( GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW );
+		glBufferSubData( GL_ARRAY_BUFFER, 0, size, data );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	}
+
+	// The camera, the shadow atlas and every shadow cascade in use, moving and still casters.
+	std::vector<VisibleObjects*> views()
+	{
+
+		std::vector<VisibleObjects*> result = { &cameraObjects, &atlasObjects };
+		for( uint32_t i = 0; i < shadowCascades.count(); ++i )
+		{
+
+			result.push_back( &shadowObjects[i] );
+			result.push_back( &stillShadowObjects[i] );
+
+		}
+		return result;
+
+	}
+
+	// count instances starting at the first one in the VAO's instance buffer.
+	void renderCubes( GLuint vertexArrayObject, GLsizei count, GLuint first = 0 )
+	{
+
+		meshes.drawInstanced( cube, vertexArrayObject, count, first );
+
+	}
+
+	// A cube VAO that reads its model matrices from instanceBuffer, starting at the first one, and for
+	// the gizmos a colour per instance from colourBuffer.
+	GLuint instancedCube( GLuint instanceBuffer, uint32_t first, GLuint colourBuffer )
+	{
+
+		GLuint vertexArrayObject;
+		GLObjects::genVertexArrays( 1, &vertexArrayObject );
+		GLState::bindVertexArray( vertexArrayObject );
+
+		// Same vertices as the cube mesh, we only add the per instance attributes.
+		meshes.bindAttributes( cube );
+
+		// A mat4 attribute takes four locations, one per column.
+		glBindBuffer( GL_ARRAY_BUFFER, instanceBuffer );
+		for( GLuint column = 0; column < 4; ++column )
+		{
+
+			glVertexAttribPointer( 3 + column, 4, GL_FLOAT, GL_FALSE, sizeof( glm::mat4 ),
+								   ( void* )( first * sizeof( glm::mat4 ) + column * sizeof( glm::vec4 ) ) );
+			glEnableVertexAttribArray( 3 + column );
+			glVertexAttribDivisor( 3 + column, 1 );
+
+		}
+
+		if( colourBuffer != 0 )
+		{
+
+			glBindBuffer( GL_ARRAY_BUFFER, colourBuffer );
+			glVertexAttribPointer( 7, 3, GL_FLOAT, GL_FALSE, sizeof( glm::vec3 ), ( void* )0 );
+			glEnableVertexAttribArray( 7 );
+			glVertexAttribDivisor( 7, 1 );
+
+		}
+
+		GLState::bindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+		return vertexArrayObject;
+
+	}
+
+	void initGeometry()
+	{
+
+		initMeshes();
+
+		// Grid of geo, always 40x40 units, 64 objects gives the original 5 unit spacing.
+		uint32_t side = ( uint32_t )std::ceil( std::sqrt( ( float )scene.objects ) );
+		float spacing = 40.0f / std::max( side, 1u );
+		objectScale = 0.8f * std::min( spacing / 5.0f, 1.0f );
+		// The moving cells go first, the still ones keep the height a moving one has halfway through
+		// its bob.
+		std::vector<glm::vec3> still;
+		firstObject = transforms.size();
+		for( uint32_t i = 0; i < scene.objects; ++i )
+		{
+
+			float x = -20.0f + spacing * ( i / side ), y = -20.0f + spacing * ( i % side );
+			float rest = sin( x + y ) * 0.1f;
+			if( std::floor( ( i + 1 ) * scene.moving ) > std::floor( i * scene.moving ) )
+			{
+
+				objectRestHeights.push_back( rest );
+				transforms.create( glm::vec3( x, rest, y ), glm::vec3( objectScale ) );
+
+			}
+
+			else
+			{
+
+				still.push_back( glm::vec3( x, rest + 1.0f, y ) );
+
+			}
+
+		}
+		firstStill = transforms.size();
+		for( const glm::vec3& position : still )
+		{
+
+			transforms.create( position, glm::vec3( objectScale ) );
+
+		}
+
+		// 40x40 quad lying flat, a bit under the origin.
+		ground = transforms.create( glm::vec3( 0.0f, -2.0f, 0.0f ), glm::vec3( 40.0f ),
+									glm::angleAxis( glm::radians( -90.0f ), glm::vec3( 1.0f, 0.0f, 0.0f ) ) );
+
+		for( uint32_t i = 0; i < scene.lights; ++i )
+		{
+
+			lightPositions.push_back( glm::vec3( 0.0f ) );
+			lightColours.push_back( glm::vec3( get_random(), get_random(), get_random() ) );
+
+			// Calculate the radius of the light volume/sphere.
+			const float maxBrightness = std::fmaxf(std::fmaxf(lightColours[i].r, lightColours[i].g), lightColours[i].b);
+			float radius = (-linear + std::sqrt(linear * linear - 4 * quadratic * (constant - (200.0f) * maxBrightness))) / (2.0f * quadratic);
+			lightRadii.push_back( radius );
+
+		}
+
+		// The gizmos' colours never change, upload them once.
+		firstGizmo = transforms.create( lightPos, glm::vec3( 0.2f ) );
+		std::vector<glm::vec3> gizmoColours = { lightCol };
+		for( uint32_t i = 0; i < scene.lights; ++i )
+		{
+
+			transforms.create( lightPositions[i], glm::vec3( 0.085f ) );
+			gizmoColours.push_back( lightColours[i] );
+
+		}
+		gizmoCount = scene.lights + 1;
+		GLObjects::genBuffers( 1, &gizmoColourBufferObject );
+		glBindBuffer( GL_ARRAY_BUFFER, gizmoColourBufferObject );
+		glBufferData( GL_ARRAY_BUFFER, gizmoColours.size() * sizeof( glm::vec3 ), gizmoColours.data(), GL_STATIC_DRAW );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+		GLObjects::genBuffers( 1, &gizmoInstanceBufferObject );
+		gizmoCubeVertexArrayObject = instancedCube( gizmoInstanceBufferObject, 0, gizmoColourBufferObject );
+
+		// The decals lie on the ground, their boxes as wide as the texture and reaching half a unit above
+		// and under it.
+		firstDecal = transforms.size();
+		for( uint32_t i = 0; i < scene.decals; ++i )
+		{
+
+			float x = -19.0f + 38.0f * get_random();
+			float z = -19.0f + 38.0f * get_random();
+			float size = 0.75f + 1.25f * get_random();
+			float angle = 360.0f * get_random();
+			transforms.create( glm::vec3( x, -2.0f, z ), glm::vec3( size * 1.76f, 0.5f, size ),
+							   glm::angleAxis( glm::radians( angle ), glm::vec3( 0.0f, 1.0f, 0.0f ) ) );
+
+		}
+
+		transforms.update();
+		// Nothing moves them in this scene, their matrices go up once here.
+		std::vector<GpuDecal> initialDecals( scene.decals );
+		DecalBatch::build( transforms.worldMatrices() + firstDecal, scene.decals, initialDecals.data() );
+		decals.init( meshes, cube, scene.decals );
+		decals.upload( initialDecals.data(), scene.decals );
+		buildObjects( movingBvh, firstObject, firstStill - firstObject );
+		buildObjects( stillBvh, firstStill, ground - firstStill );
+
+		for( VisibleObjects* objects : views() )
+		{
+
+			GLObjects::genBuffers( 1, &objects->instanceBufferObject );
+			objects->vertexArrayObject = instancedCube( objects->instanceBufferObject, 0, 0 );
+
+		}
+
+		// Grown once, preparing a frame doesn't allocate afterwards.
+		for( FrameData& frame : frames )
+		{
+
+			frame.lights.reserve( scene.lights );
+			frame.shadowCandidates.reserve( scene.lights );
+			frame.atlasViews.reserve( shadowAtlas.maxLights() * ShadowAtlas::FACES );
+			frame.atlasTiles.reserve( shadowAtlas.maxLights() * ShadowAtlas::FACES );
+			// These grow to what the faces actually see, reserving every object for every face adds up.
+			frame.atlasObjects.resize( shadowAtlas.maxLights() * ShadowAtlas::FACES );
+			frame.gizmos.reserve( gizmoCount );
+			frame.decals.resize( scene.decals );
+			std::vector<DrawList*> lists = { &frame.cameraObjects };
+			for( uint32_t i = 0; i < shadowCascades.count(); ++i )
+			{
+
+				lists.push_back( &frame.shadowObjects[i] );
+				lists.push_back( &frame.stillShadowObjects[i] );
+
+			}
+			for( DrawList* list : lists )
+			{
+
+				list->indices.reserve( scene.objects );
+				list->matrices.reserve( scene.objects );
+				list->order.reserve( scene.objects );
+
+			}
+
+		}
+
+		uint32_t threads = scene.threads != 0 ? scene.threads : std::max( 1u, std::thread::hardware_concurrency() );
+		jobs.init( threads - 1 );
+
+	}
+
+	void buildObjects( Bvh& bvh, Entity first, uint32_t count )
+	{
+
+		std::vector<Aabb> boxes;
+		for( uint32_t i = 0; i < count; ++i )
+		{
+
+			boxes.push_back( Aabb::fromUnitCube( transforms.worldMatrix( first + i ) ) );
+
+		}
+		bvh.build( boxes );
+
+	}
+
+	// https://stackoverflow.com/questions/686353/random-float-number-generation
+	float get_random()
+	{
+		static std::default_random_engine e;
+		static std::uniform_real_distribution<> dis(0, 1); // rage 0 - 1
+		return dis(e);
+	}
+
+	// Every static mesh the engine draws, uploaded once. They all share the G-buffer pass' attribute
+	// locations: position 0, normal 1 and texture coordinates 2.
+	void initMeshes()
+	{
+
+		std::vector<GLfloat> quadVertices =
+		{
+
+			// positions         // normals       // texCoords  
+			 0.5f,  0.5f, 0.0f,  0.0, 0.0, 1.0f,  1.0f, 1.0f,    // top right
+			 0.5f, -0.5f, 0.0f,  0.0, 0.0, 1.0f,  1.0f, 0.0f,    // bottom right
+			-0.5f, -0.5f, 0.0f,  0.0, 0.0, 1.0f,  0.0f, 0.0f,    // bottom left
+			-0.5f,  0.5f, 0.0f,  0.0, 0.0, 1.0f,  0.0f, 1.0f    // top left 
+
+			// To compute the normals for a quad we only need to calculate the vector from each point 
+			// to each of it's neighbors:
+			//                             * A ------------------- * B
+			//                   ^         ^                       |
+			//                    \        |                       |
+			//                     \       |                       |
+			//                      \      |                       |
+			//                    e  \     |                       |  QUAD
+			//                        \    |                       |
+			//                         \   |-----                  |
+			//                          \  |     |                 |
+			//                           \ | D   |                 | C
+			//                             *---------------------->* 
+			// So if we want to calculate the normal for vertex D, we compute the cross product of vector A - D and
+			// vector C - D, which will give us the perpendicular/normal of D = e.
+		};
+
+		std::vector<GLuint> quadIndices =
+		{
+
+			0, 1, 3, // first triangle
+			1, 2, 3  // second triangle
+
+		};
+
+		groundQuad = meshes.create( quadVertices, { { 0, 3 }, { 1, 3 }, { 2, 2 } }, quadIndices );
+
+		// Full screen, positions and texture coordinates only.
+		screenQuad = meshes.create(
+			{
+				// positions        // texture Coords
+				-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
+				-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+				 1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
+				 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+			}, { { 0, 3 }, { 1, 2 } }, {}, GL_TRIANGLE_STRIP );
+
+		std::vector<GLfloat> cubeVertices = {
+			// back face
+			-1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
+			 1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
+			 1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 0.0f, // bottom-right         
+			 1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
+			-1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
+			-1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 1.0f, // top-left
+			// front face
+			-1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
+			 1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
+			 1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
+			 1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
+			-1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
+			-1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
+			// left face
+			-1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
+			-1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
+			-1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
+			-1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
+			-1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
+			-1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
+			// right face
+			 1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
+			 1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
+			 1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right         
+			 1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
+			 1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
+			 1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left     
+			// bottom face
+			-1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
+			 1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
+			 1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
+			 1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
+			-1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
+			-1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
+			// top face
+			-1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
+			 1.0f,  1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
+			 1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right     
+			 1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
+			-1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
+			-1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left        
+		};
+		cube = meshes.create( cubeVertices, { { 0, 3 }, { 1, 3 }, { 2, 2 } } );
+
+		// Unit sphere for the light volumes, only positions.
+		const uint16_t RINGS = 12, SEGMENTS = 16;
+		const float PI = 3.14159265359f;
+		// The flat faces cut inside the round sphere, push the vertices out so the mesh contains
+		// the whole light radius.
+		const float scale = 1.0f / ( cos( PI / SEGMENTS ) * cos( PI / ( 2.0f * RINGS ) ) );
+
+		std::vector<GLfloat> sphereVertices;
+		for( uint16_t ring = 0; ring <= RINGS; ++ring )
+		{
+
+			float phi = PI * ring / RINGS;
+			for( uint16_t segment = 0; segment <= SEGMENTS; ++segment )
+			{
+
+				float theta = 2.0f * PI * segment / SEGMENTS;
+				sphereVertices.push_back( scale * sin( phi ) * cos( theta ) );
+				sphereVertices.push_back( scale * cos( phi ) );
+				sphereVertices.push_back( scale * sin( phi ) * sin( theta ) );
+
+			}
+
+		}
+
+		// Counter clockwise seen from outside, like the cube.
+		std::vector<GLuint> sphereIndices;
+		for( uint16_t ring = 0; ring < RINGS; ++ring )
+		{
+
+			for( uint16_t segment = 0; segment < SEGMENTS; ++segment )
+			{
+
+				GLuint a = ring * ( SEGMENTS + 1 ) + segment, b = a + SEGMENTS + 1;
+				sphereIndices.insert( sphereIndices.end(), { a, b + 1, b, a, a + 1, b + 1 } );
+
+			}
+
+		}
+		sphere = meshes.create( sphereVertices, { { 0, 3 } }, sphereIndices );
+
+	}
+
+	void free()
+	{
+
+		// Apparently freeing resources is something that the driver must do!
+		// https://community.khronos.org/t/vao-deleting-causes-strange-memory-problems/74691
+		// Free the meshes.
+		meshes.free();
+
+		// Free the instancing.
+		GLObjects::deleteBuffers( 1, &gizmoInstanceBufferObject );
+		GLObjects::deleteBuffers( 1, &gizmoColourBufferObject );
+		for( VisibleObjects* objects : views() )
+		{
+
+			GLObjects::deleteBuffers( 1, &objects->instanceBufferObject );
+			GLObjects::deleteVertexArrays( 1, &objects->vertexArrayObject );
+
+		}
+		GLObjects::deleteVertexArrays( 1, &gizmoCubeVertexArrayObject );
+
+		// Free the depth map.
+		shadowCascades.free();
+		shadowAtlas.free();
+
+		// Free the GBuffer, the shadow mask and the lighting targets.
+		targets.free();
+
+		// Free the decals.
+		decals.free();
+
+		// Free the headless output.
+		if( outputFBO != 0 )
+		{
+
+			GLObjects::deleteRenderbuffers( 1, &outputColour );
+			GLObjects::deleteRenderbuffers( 1, &outputDepth );
+			GLObjects::deleteFramebuffers( 1, &outputFBO );
+
+		}
+
+		// No decode can still be running after this.
+		jobs.free();
+		streamer.free();
+		profiler.free();
+		lightBuffer.free();
+		lightCulling.free();
+		lightingShaders.free();
+		volumeShaders.free();
+
+		// Free the shaders.
+		Shader* shaders[] = { shaderG, shaderF, shaderShadow, shaderMask, shaderD, shaderStencil };
+		for( Shader* shader : shaders )
+		{
+
+			GLObjects::deleteProgram( shader->ID );
+			delete shader;
+
+		}
+
+	}
+
+	// Callbacks
+	static void framebufferResizeCallback( GLFWwindow* window, int, int )
+	{
+
+		// The targets are re-created between frames, see updateResolution().
+		auto app = reinterpret_cast<RenderEngine*>( glfwGetWindowUserPointer( window ) );
+		app->framebufferResized = true;
+
+	}
+
+	void processInput( GLFWwindow* window )
+	{
+
+		float camSpeed = deltaTime * SPEED;
+
+		// Close the app when pressing the ESC key.
+		if( glfwGetKey( window, GLFW_KEY_ESCAPE ) == GLFW_PRESS )
+		{
+		
+			glfwSetWindowShouldClose( window, true );
+		
+		}
+
+		// To keep everything frame rate independent the "tick" is used.
+
+		// Move forward. Simple vector addition every scalar in camPos added to every scalar in camFront
+		// "weighted" by the deltaTime to abstract the frame dependency.
+		// Adding two vector gives a sort of average between two vectors.
+		//                 * B
+		//                 ^^
+		//                 | \  camFront
+		//         camPos  |  \
+		//                 |   ^ 
+		//                 |  /
+		//                 | /  camPosOld 
+		//                 |/
+		//                 * A
+		if( glfwGetKey( window, GLFW_KEY_W ) == GLFW_PRESS )
+		{
+
+			camPos += camSpeed * camFront;
+
+		}
+
+		// Same as forward but doing the opposite operation. This 
+		if( glfwGetKey( window, GLFW_KEY_S ) == GLFW_PRESS )
+		{
 
 			camPos -= camSpeed * camFront;
 
@@ -929,6 +2407,61 @@ private:
 
 	}
 
+	static void keyCallback( GLFWwindow* window, int key, int, int action, int )
+	{
+
+		auto app = reinterpret_cast<RenderEngine*>( glfwGetWindowUserPointer( window ) );
+
+		if( action != GLFW_PRESS )
+		{
+
+			return;
+
+		}
+
+		// Print the per pass timings.
+		if( key == GLFW_KEY_P )
+		{
+
+			app->profiler.dump( std::cout );
+			GLObjects::dump( std::cout );
+
+		}
+
+		// Cycle through the lighting modes, handy to compare them.
+		if( key == GLFW_KEY_L )
+		{
+
+			app->cycleLightingMode();
+
+		}
+
+	}
+
+	// Tiled -> full screen -> volumes -> tiled, tiled gets skipped without shader storage buffers.
+	void cycleLightingMode()
+	{
+
+		switch( lightingMode )
+		{
+
+			case LightingMode::Tiled:
+				lightingMode = LightingMode::FullScreen;
+				break;
+			case LightingMode::FullScreen:
+				lightingMode = LightingMode::Volumes;
+				break;
+			case LightingMode::Volumes:
+				lightingMode = lightBuffer.usesStorage() ? LightingMode::Tiled : LightingMode::FullScreen;
+				break;
+
+		}
+
+		const char* names[] = { "full screen", "tiled", "volumes" };
+		std::cout << "Lighting: " << names[ ( int )lightingMode ] << std::endl;
+
+	}
+
 	static void mouseClickCallBack( GLFWwindow* window, int button, int action, int mods )
 	{
 	
@@ -957,15 +2490,383 @@ private:
 
 };
 
-int main()
+// A flag's value, the next argument, as a whole number or as a number. Anything else isn't a usage we
+// know, the message says which flag got what.
+static uint32_t countArgument( char** argv, int& i )
+{
+
+	const char* flag = argv[i];
+	std::string value = argv[++i];
+	size_t parsed = 0;
+	unsigned long count = 0;
+	try
+	{
+
+		count = value[0] != '-' ? std::stoul( value, &parsed ) : 0;
+
+	}
+
+	catch( const std::exception& )
+	{
+
+		parsed = 0;
+
+	}
+
+	if( parsed == 0 || parsed != value.size() || count > UINT32_MAX )
+	{
+
+		throw std::runtime_error( std::string( flag ) + " expects a whole number, got \"" + value + "\"" );
+
+	}
+	return ( uint32_t )count;
+
+}
+
+static float numberArgument( char** argv, int& i )
 {
 
-	RenderEngine engine;
+	const char* flag = argv[i];
+	std::string value = argv[++i];
+	size_t parsed = 0;
+	float number = 0.0f;
+	try
+	{
+
+		number = std::stof( value, &parsed );
+
+	}
+
+	catch( const std::exception& )
+	{
+
+		parsed = 0;
 
+	}
+
+	if( parsed == 0 || parsed != value.size() )
+	{
+
+		throw std::runtime_error( std::string( flag ) + " expects a number, got \"" + value + "\"" );
+
+	}
+	return number;
+
+}
+
+// Usage:
+//   DeferredRenderer                         Interactive, opens a window.
+//   DeferredRenderer --headless [options]    Renders offscreen and writes a JSON benchmark report.
+//     --frames N        Number of frames to render (300).
+//     --json PATH       Where to write the report (benchmark.json).
+//     --capture PATH    Also dump the last frame as a PPM image.
+//     --still-camera    The benchmark camera doesn't orbit.
+//   Both modes:
+//     --lights N        Number of point lights (30).
+//     --objects N       Number of cubes in the grid (64).
+//     --moving F        Fraction of the objects that move, the others cast cached shadows (1).
+//     --threads N       Threads preparing frames, counting the GL thread (every core).
+//     --cascades N      Shadow cascades, 1 to 4 (4).
+//     --cascade-split L Split scheme, 0 is uniform, 1 logarithmic, in between blends them (0.75).
+//     --shadow-filter F "pcf" (default) or "pcss".
+//     --pcf-radius N    Shadow filter kernel radius, ( 2N + 1 )^2 comparisons (1).
+//     --shadowed-lights N Point lights that can cast shadows, at most 32 (16).
+//     --shadow-atlas N  The point light shadow atlas is N x N texels (2048).
+//     --shadow-cache M  "on" (default) or "off", keeps the still casters' shadows between frames.
+//     --decals N        Number of decals on the ground, all drawn at once (32).
+//     --spotlight M     "on" (default) or "off", the lighting drops the spotlight and its shadows.
+//     --shader-cache DIR  Keeps the linked programs in DIR between launches ("ShaderCache"), "off" always compiles.
+//     --stream-budget KB  Texture data uploaded per frame at most, the rest streams in over the next ones (2048).
+//     --depth-prepass   Draw the camera's depth first, the G-buffer pass then only shades visible fragments.
+//     --dynamic-resolution MS  Scale the render size to keep the GPU frame time under MS milliseconds.
+//     --min-scale F     The smallest render size dynamic resolution can go to, per axis (0.5).
+//     --lighting MODE   "tiled" (default), "fullscreen" or "volumes", L cycles through them at runtime.
+int main( int argc, char** argv )
+{
+
+	bool headless = false;
+	BenchmarkSettings settings;
+	SceneSettings scene;
+	LightingMode lightingMode = LightingMode::Tiled;
 	try
 	{
 
-		engine.run();
+		for( int i = 1; i < argc; ++i )
+		{
+
+			bool hasValue = i + 1 < argc;
+			if( std::strcmp( argv[i], "--headless" ) == 0 )
+			{
+
+				headless = true;
+
+			}
+
+			else if( std::strcmp( argv[i], "--frames" ) == 0 && hasValue )
+			{
+
+				settings.frames = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--json" ) == 0 && hasValue )
+			{
+
+				settings.jsonPath = argv[++i];
+
+			}
+
+			else if( std::strcmp( argv[i], "--capture" ) == 0 && hasValue )
+			{
+
+				settings.capturePath = argv[++i];
+
+			}
+
+			else if( std::strcmp( argv[i], "--lights" ) == 0 && hasValue )
+			{
+
+				scene.lights = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--objects" ) == 0 && hasValue )
+			{
+
+				scene.objects = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--moving" ) == 0 && hasValue )
+			{
+
+				scene.moving = numberArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--still-camera" ) == 0 )
+			{
+
+				settings.orbit = false;
+
+			}
+
+			else if( std::strcmp( argv[i], "--threads" ) == 0 && hasValue )
+			{
+
+				scene.threads = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--cascades" ) == 0 && hasValue )
+			{
+
+				scene.cascades.count = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--cascade-split" ) == 0 && hasValue )
+			{
+
+				scene.cascades.splitLambda = numberArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--shadow-filter" ) == 0 && hasValue )
+			{
+
+				std::string filter = argv[++i];
+				if( filter == "pcf" )
+				{
+
+					scene.shadowFilter.filter = ShadowFilter::Pcf;
+
+				}
+
+				else if( filter == "pcss" )
+				{
+
+					scene.shadowFilter.filter = ShadowFilter::Pcss;
+
+				}
+
+				else
+				{
+
+					std::cerr << "Unknown shadow filter: " << filter << std::endl;
+					return EXIT_FAILURE;
+
+				}
+
+			}
+
+			else if( std::strcmp( argv[i], "--pcf-radius" ) == 0 && hasValue )
+			{
+
+				scene.shadowFilter.pcfRadius = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--shadowed-lights" ) == 0 && hasValue )
+			{
+
+				scene.shadowAtlas.lights = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--shadow-atlas" ) == 0 && hasValue )
+			{
+
+				scene.shadowAtlas.size = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--dynamic-resolution" ) == 0 && hasValue )
+			{
+
+				scene.resolution.enabled = true;
+				scene.resolution.budgetMs = numberArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--min-scale" ) == 0 && hasValue )
+			{
+
+				scene.resolution.minScale = numberArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--decals" ) == 0 && hasValue )
+			{
+
+				scene.decals = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--spotlight" ) == 0 && hasValue )
+			{
+
+				std::string spotlight = argv[++i];
+				if( spotlight == "on" || spotlight == "off" )
+				{
+
+					scene.spotlight = spotlight == "on";
+
+				}
+
+				else
+				{
+
+					std::cerr << "Unknown spotlight mode: " << spotlight << std::endl;
+					return EXIT_FAILURE;
+
+				}
+
+			}
+
+			else if( std::strcmp( argv[i], "--shader-cache" ) == 0 && hasValue )
+			{
+
+				std::string directory = argv[++i];
+				scene.shaderCache = directory == "off" ? "" : directory;
+
+			}
+
+			else if( std::strcmp( argv[i], "--stream-budget" ) == 0 && hasValue )
+			{
+
+				scene.streamBudget = countArgument( argv, i );
+
+			}
+
+			else if( std::strcmp( argv[i], "--depth-prepass" ) == 0 )
+			{
+
+				scene.depthPrepass = true;
+
+			}
+
+			else if( std::strcmp( argv[i], "--shadow-cache" ) == 0 && hasValue )
+			{
+
+				std::string cache = argv[++i];
+				if( cache == "on" || cache == "off" )
+				{
+
+					scene.cascades.cache = cache == "on";
+
+				}
+
+				else
+				{
+
+					std::cerr << "Unknown shadow cache mode: " << cache << std::endl;
+					return EXIT_FAILURE;
+
+				}
+
+			}
+
+			else if( std::strcmp( argv[i], "--lighting" ) == 0 && hasValue )
+			{
+
+				std::string mode = argv[++i];
+				if( mode == "tiled" )
+				{
+
+					lightingMode = LightingMode::Tiled;
+
+				}
+
+				else if( mode == "fullscreen" )
+				{
+
+					lightingMode = LightingMode::FullScreen;
+
+				}
+
+				else if( mode == "volumes" )
+				{
+
+					lightingMode = LightingMode::Volumes;
+
+				}
+
+				else
+				{
+
+					std::cerr << "Unknown lighting mode: " << mode << std::endl;
+					return EXIT_FAILURE;
+
+				}
+
+			}
+
+			else
+			{
+
+				std::cerr << "Unknown argument: " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+
+			}
+
+		}
+
+		RenderEngine engine( scene, lightingMode );
+
+		if( headless )
+		{
+
+			engine.runHeadless( settings );
+
+		}
+
+		else
+		{
+
+			engine.run();
+
+		}
 
 	}
 
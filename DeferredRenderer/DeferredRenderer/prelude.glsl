@@ -0,0 +1,112 @@
+// Shared by every program, Shader::injectDefines() puts it after the #version line and the defines so
+// the blocks below only show up where a define asks for them.
+
+// Octahedral encoding, the unit sphere is projected onto an octahedron and the octahedron is unfolded
+// onto a square, two 16 bit values are plenty for a normal.
+// http://jcgt.org/published/0003/02/01/
+vec2 signNotZero( vec2 v )
+{
+
+	return vec2( v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0 );
+
+}
+
+vec2 encodeNormal( vec3 n )
+{
+
+	n /= abs( n.x ) + abs( n.y ) + abs( n.z );
+	vec2 e = n.z >= 0.0 ? n.xy : ( 1.0 - abs( n.yx ) ) * signNotZero( n.xy );
+	// The target is unsigned normalized.
+	return e * 0.5 + 0.5;
+
+}
+
+vec3 decodeNormal( vec2 e )
+{
+
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3( e, 1.0 - abs( e.x ) - abs( e.y ) );
+	float t = max( -n.z, 0.0 );
+	n.xy += vec2( n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t );
+	return normalize( n );
+
+}
+
+#ifdef LIGHT_LIST
+// The point lights, this has to match GpuLight in LightBuffer.h, the floats after each vec3 keep the
+// layout identical under std140 and std430.
+struct Light
+{
+
+    vec3 Position;
+    float Radius;
+    vec3 Colour;
+    float Linear;
+    float Quadratic;
+    int Shadow;
+    float Padding1, Padding2;
+
+};
+
+// The whole light list lives in a buffer, so there is no hard-coded number of lights
+// anymore, the CPU tells us how many of them are valid this frame.
+#ifdef LIGHTS_UBO
+layout( std140, binding = 0 ) uniform LightBlock
+{
+
+	Light lights[MAX_UBO_LIGHTS];
+
+};
+#else
+layout( std430, binding = 0 ) readonly buffer LightBlock
+{
+
+	Light lights[];
+
+};
+#endif
+#endif
+
+#ifdef POINT_SHADOWS
+// Point light shadows, six faces per shadowed light in the atlas, see ShadowAtlas.h. Has to match
+// GpuShadowView.
+struct ShadowView
+{
+
+	mat4 ViewProjection;
+	// Where the face is in the atlas, offset in xy and size in zw.
+	vec4 Rect;
+
+};
+layout( std140, binding = 1 ) uniform ShadowViewBlock
+{
+
+	ShadowView shadowViews[MAX_SHADOW_VIEWS];
+
+};
+uniform sampler2DShadow shadowAtlas;
+
+// How lit fragPos is by a shadowed point light whose +X face is first, the others follow it in the order
+// -X, +Y, -Y, +Z, -Z. The face is the one along the biggest axis of the light to fragment vector.
+float pointShadow( int first, vec3 lightPos, vec3 fragPos, vec3 normal )
+{
+
+	vec3 d = fragPos - lightPos;
+	vec3 a = abs( d );
+	int face = a.x >= a.y && a.x >= a.z ? ( d.x > 0.0 ? 0 : 1 ) : ( a.y >= a.z ? ( d.y > 0.0 ? 2 : 3 ) : ( d.z > 0.0 ? 4 : 5 ) );
+	ShadowView view = shadowViews[first + face];
+
+	// A 90 degree face spreads its texels over twice the distance, the fragment moves out along its normal
+	// by a texel and a half and the acne is gone without detaching the shadows.
+	float atlasSize = float( textureSize( shadowAtlas, 0 ).x );
+	float texel = 2.0 * max( max( a.x, a.y ), a.z ) / ( view.Rect.z * atlasSize );
+	vec4 clip = view.ViewProjection * vec4( fragPos + normal * texel * 1.5, 1.0 );
+	vec3 coords = clip.xyz / clip.w * 0.5 + 0.5;
+
+	// Stay half a texel inside the tile, the bilinear comparison would read the neighbouring one.
+	vec2 margin = vec2( 0.5 / atlasSize );
+	vec2 uv = clamp( view.Rect.xy + coords.xy * view.Rect.zw, view.Rect.xy + margin, view.Rect.xy + view.Rect.zw - margin );
+	return texture( shadowAtlas, vec3( uv, coords.z ) );
+
+}
+#endif
\ No newline at end of file
@@ -1,10 +1,15 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+// Per instance, same buffer as the G-buffer pass.
+layout (location = 3) in mat4 aModel;
 
 uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+
+// Also the camera's depth pre-pass, same math as gBuffer.vert so the depths match exactly.
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    vec4 worldPos = aModel * vec4( aPos, 1 );
+    gl_Position = lightSpaceMatrix * worldPos;
 }
\ No newline at end of file
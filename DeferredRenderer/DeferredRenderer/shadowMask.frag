@@ -0,0 +1,183 @@
+#version 330 core
+// Screen space shadows. The G-buffer pass used to filter the shadow map for every fragment it rasterized,
+// overdrawn ones included, now this full screen pass does it once per pixel from the G-buffer's depth.
+// The lighting passes multiply by the result.
+layout (location = 0) out float ShadowMask;
+
+in vec2 TexCoords;
+
+uniform sampler2D gDepth;
+uniform sampler2D gNormal;
+// The same cascades twice: with the hardware depth comparison (bilinear PCF on every fetch) and raw for
+// the PCSS blocker search, see ShadowCascades::bindTextures.
+uniform sampler2DArrayShadow shadowMap;
+uniform sampler2DArray shadowDepths;
+
+uniform mat4 invViewProjection;
+uniform mat4 view;
+uniform vec3 lightPos;
+
+// Every cascade's light space matrix and the view depth it ends at (MAX_CASCADES comes from ShadowCascades.h).
+uniform mat4 lightSpaceMatrices[MAX_CASCADES];
+uniform float cascadeSplits[MAX_CASCADES];
+uniform int cascadeCount;
+
+// PCF_RADIUS (and SHADOW_PCSS when enabled) come from ShadowFilterSettings.
+#ifdef SHADOW_PCSS
+// The light's size in shadow map texture space, the penumbras grow with it.
+uniform float lightSize;
+#endif
+
+// Rebuilds the world position from the depth buffer, uv and depth both in [0, 1].
+vec3 worldFromDepth( vec2 uv, float depth )
+{
+
+	vec4 position = invViewProjection * vec4( vec3( uv, depth ) * 2.0 - 1.0, 1.0 );
+	return position.xyz / position.w;
+
+}
+
+// The first cascade that reaches as far as the pixel, past the last split we keep the last one.
+int cascadeIndex( float viewDepth )
+{
+
+	int cascade = 0;
+	for( int i = 0; i < cascadeCount - 1; ++i )
+	{
+
+		if( viewDepth > cascadeSplits[i] )
+		{
+
+			cascade = i + 1;
+
+		}
+
+	}
+	return cascade;
+
+}
+
+float shadowBias( float d )
+{
+
+	return max( 0.05 * ( 1.0 - d ), 0.005 );
+
+}
+
+// How lit the pixel is, averaged over a ( 2 * PCF_RADIUS + 1 )^2 grid of comparisons step apart.
+float filterShadow( vec3 coords, int cascade, vec2 step )
+{
+
+	float lit = 0.0;
+	for( int x = -PCF_RADIUS; x <= PCF_RADIUS; ++x )
+	{
+
+		for( int y = -PCF_RADIUS; y <= PCF_RADIUS; ++y )
+		{
+
+			lit += texture( shadowMap, vec4( coords.xy + vec2( x, y ) * step, float( cascade ), coords.z ) );
+
+		}
+
+	}
+	return lit / float( ( 2 * PCF_RADIUS + 1 ) * ( 2 * PCF_RADIUS + 1 ) );
+
+}
+
+#ifdef SHADOW_PCSS
+// Back from a stored [0, 1] depth to the distance from the light. The matrix is projection * view and
+// the projection a perspective one: its last row is minus the view's z row, its third row is
+// a * z + b, so both a and b can be read back from it.
+float lightDistance( int cascade, float depth )
+{
+
+	mat4 m = lightSpaceMatrices[cascade];
+	vec4 row2 = vec4( m[0][2], m[1][2], m[2][2], m[3][2] );
+	vec4 row3 = vec4( m[0][3], m[1][3], m[2][3], m[3][3] );
+	float a = -dot( row2.xyz, row3.xyz );
+	float b = row2.w + a * row3.w;
+	return b / ( depth * 2.0 - 1.0 + a );
+
+}
+
+// Percentage closer soft shadows: the average depth of whatever blocks the light around the pixel says
+// how wide the penumbra is, then PCF with a kernel that wide.
+// https://developer.download.nvidia.com/shaderlibrary/docs/shadow_PCSS.pdf
+float softShadow( vec3 coords, int cascade, float receiver, vec2 texelSize )
+{
+
+	const int BLOCKER_RADIUS = 2;
+	vec2 searchStep = vec2( lightSize / float( BLOCKER_RADIUS ) );
+	float blockers = 0.0, blockerDepth = 0.0;
+	for( int x = -BLOCKER_RADIUS; x <= BLOCKER_RADIUS; ++x )
+	{
+
+		for( int y = -BLOCKER_RADIUS; y <= BLOCKER_RADIUS; ++y )
+		{
+
+			float depth = texture( shadowDepths, vec3( coords.xy + vec2( x, y ) * searchStep, float( cascade ) ) ).r;
+			if( depth < coords.z )
+			{
+
+				blockers += 1.0;
+				blockerDepth += depth;
+
+			}
+
+		}
+
+	}
+
+	if( blockers == 0.0 )
+	{
+
+		return 1.0;
+
+	}
+
+	float blocker = lightDistance( cascade, blockerDepth / blockers );
+	float penumbra = lightSize * ( receiver - blocker ) / blocker;
+	return filterShadow( coords, cascade, max( texelSize, vec2( penumbra / float( max( PCF_RADIUS, 1 ) ) ) ) );
+
+}
+#endif
+
+void main()
+{
+
+	float depth = texture( gDepth, TexCoords ).r;
+	// Nothing was drawn here, nothing to shadow.
+	if( depth == 1.0 )
+	{
+
+		ShadowMask = 1.0;
+		return;
+
+	}
+
+	vec3 FragPos = worldFromDepth( TexCoords, depth );
+	vec3 Normal = decodeNormal( texture( gNormal, TexCoords ).rg );
+	int cascade = cascadeIndex( -( view * vec4( FragPos, 1.0 ) ).z );
+
+	vec4 fragPosLightSpace = lightSpaceMatrices[cascade] * vec4( FragPos, 1.0 );
+	vec3 coords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+	// Outside the far plane of the light's frustum, keep it lit.
+	if( coords.z > 1.0 )
+	{
+
+		ShadowMask = 1.0;
+		return;
+
+	}
+
+	// The bias depends on the slope between the surface and the light.
+	coords.z -= shadowBias( dot( Normal, normalize( lightPos - FragPos ) ) );
+	vec2 texelSize = 1.0 / vec2( textureSize( shadowDepths, 0 ).xy );
+
+#ifdef SHADOW_PCSS
+	ShadowMask = softShadow( coords, cascade, fragPosLightSpace.w, texelSize );
+#else
+	ShadowMask = filterShadow( coords, cascade, texelSize );
+#endif
+
+}
\ No newline at end of file